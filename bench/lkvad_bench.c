@@ -0,0 +1,556 @@
+// End-to-end benchmark: playlist generation throughput for 1e3..1e7
+// entries and URL verification throughput against an in-process mock
+// HTTP server speaking HTTP/1.1 or cleartext HTTP/2 (h2c).
+//
+// Build from the repository root:
+//   cc -O2 -o lkvad_bench bench/lkvad_bench.c -lcurl -lpthread -lz
+// Usage: ./lkvad_bench [--max-entries n] [--max-probes n] [--latency-ms ms]
+//                      [--failure-rate r] [--output file]
+//
+// Every result is appended to the output file (default bench_output.txt)
+// as one line of key=value pairs, so runs can be diffed or parsed.
+
+#define _GNU_SOURCE  // memmem
+#define main lkvad_main
+#include "../lkvad.c"
+#undef main
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MOCK_MAX_CONNECTIONS 1024
+#define MOCK_READ_CHUNK 16384
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LENGTH 24
+
+// Mock origin settings, fixed before the server thread starts
+typedef struct {
+    double latency;               // seconds between request and response
+    double failure_rate;          // fraction of requests answered 404
+} mock_config_t;
+
+typedef struct {
+    int fd;
+    unsigned generation;          // bumped on close so queued responses for the old fd are dropped
+    bool h2;
+    bool preface_done;
+    bool settings_sent;
+    char *in;
+    size_t in_len;
+    size_t in_capacity;
+    char *out;
+    size_t out_len;
+    size_t out_capacity;
+} mock_conn_t;
+
+// Response waiting for its latency to elapse. Latency is constant, so
+// due times are monotonic and a FIFO keeps them ordered.
+typedef struct {
+    double due;
+    int conn;
+    unsigned generation;
+    uint32_t stream;              // HTTP/2 stream id, 0 for HTTP/1.1
+    bool head;
+    bool fail;
+} mock_response_t;
+
+typedef struct {
+    mock_config_t config;
+    int listen_fd;
+    int port;
+    mock_conn_t conns[MOCK_MAX_CONNECTIONS];
+    mock_response_t *queue;
+    size_t queue_head;
+    size_t queue_len;
+    size_t queue_capacity;
+    uint64_t requests;
+    volatile bool stop;
+    pthread_t thread;
+} mock_server_t;
+
+void buffer_append(char **buf, size_t *len, size_t *capacity, const void *data, size_t n) {
+    if (*len + n > *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 4096;
+        while (grown < *len + n) grown *= 2;
+        char *p = realloc(*buf, grown);
+        if (!p) return;
+        *buf = p;
+        *capacity = grown;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+void mock_close(mock_server_t *server, int id) {
+    mock_conn_t *conn = &server->conns[id];
+    close(conn->fd);
+    conn->fd = -1;
+    conn->generation++;
+    conn->in_len = 0;
+    conn->out_len = 0;
+}
+
+// Deterministic failure pattern: splitmix64 of the request sequence number
+bool mock_should_fail(mock_server_t *server) {
+    uint64_t z = (server->requests++ + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) / (double)(1ULL << 53) < server->config.failure_rate;
+}
+
+void mock_enqueue(mock_server_t *server, int id, uint32_t stream, bool head) {
+    if (server->queue_head + server->queue_len == server->queue_capacity) {
+        // Compact before growing, the consumed head is usually most of the array
+        memmove(server->queue, server->queue + server->queue_head, server->queue_len * sizeof(mock_response_t));
+        server->queue_head = 0;
+        if (server->queue_len == server->queue_capacity) {
+            size_t capacity = server->queue_capacity ? server->queue_capacity * 2 : 1024;
+            mock_response_t *queue = realloc(server->queue, capacity * sizeof(mock_response_t));
+            if (!queue) return;
+            server->queue = queue;
+            server->queue_capacity = capacity;
+        }
+    }
+    mock_response_t *r = &server->queue[server->queue_head + server->queue_len++];
+    r->due = monotonic_seconds() + server->config.latency;
+    r->conn = id;
+    r->generation = server->conns[id].generation;
+    r->stream = stream;
+    r->head = head;
+    r->fail = mock_should_fail(server);
+}
+
+void h2_frame(mock_conn_t *conn, uint8_t type, uint8_t flags, uint32_t stream, const void *payload, size_t len) {
+    unsigned char header[9] = {
+        (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len, type, flags,
+        (unsigned char)(stream >> 24 & 0x7f), (unsigned char)(stream >> 16), (unsigned char)(stream >> 8),
+        (unsigned char)stream
+    };
+    buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, header, sizeof(header));
+    if (len) buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, payload, len);
+}
+
+void mock_respond(mock_server_t *server, const mock_response_t *r) {
+    mock_conn_t *conn = &server->conns[r->conn];
+    if (conn->fd < 0 || conn->generation != r->generation) return;
+    
+    if (conn->h2) {
+        // HPACK static table: index 8 is ":status 200", 13 is ":status 404".
+        // HEADERS with END_STREAM | END_HEADERS ends the exchange without a body.
+        unsigned char status = r->fail ? 0x8d : 0x88;
+        h2_frame(conn, 0x1, 0x5, r->stream, &status, 1);
+    } else if (r->fail) {
+        static const char response[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, response, sizeof(response) - 1);
+    } else {
+        // GETs (range probes) get a one byte body, HEADs only its length
+        static const char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n";
+        static const char get[] = "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nx";
+        if (r->head) {
+            buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, head, sizeof(head) - 1);
+        } else {
+            buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, get, sizeof(get) - 1);
+        }
+    }
+}
+
+// Parse complete HTTP/1.1 requests out of the input buffer
+void mock_parse_h1(mock_server_t *server, int id) {
+    mock_conn_t *conn = &server->conns[id];
+    size_t pos = 0;
+    for (;;) {
+        char *end = memmem(conn->in + pos, conn->in_len - pos, "\r\n\r\n", 4);
+        if (!end) break;
+        bool head = strncmp(conn->in + pos, "HEAD ", 5) == 0;
+        bool upgrade = strcasestr(conn->in + pos, "\r\nUpgrade: h2c") != NULL &&
+                       strcasestr(conn->in + pos, "\r\nUpgrade: h2c") < end;
+        pos = end + 4 - conn->in;
+        if (upgrade) {
+            // h2c upgrade: the request becomes stream 1 and the client preface follows
+            static const char response[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            buffer_append(&conn->out, &conn->out_len, &conn->out_capacity, response, sizeof(response) - 1);
+            conn->h2 = true;
+            h2_frame(conn, 0x4, 0x0, 0, NULL, 0);
+            conn->settings_sent = true;
+            mock_enqueue(server, id, 1, head);
+            break;
+        }
+        mock_enqueue(server, id, 0, head);
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+}
+
+// Parse HTTP/2 frames after an h2c upgrade or a prior-knowledge preface.
+// Request headers are not decoded: every stream that finishes its header
+// block gets a response, which is all a probe needs.
+void mock_parse_h2(mock_server_t *server, int id) {
+    mock_conn_t *conn = &server->conns[id];
+    size_t pos = 0;
+    if (!conn->preface_done) {
+        if (conn->in_len < H2_PREFACE_LENGTH) return;
+        pos = H2_PREFACE_LENGTH;
+        conn->preface_done = true;
+        if (!conn->settings_sent) {
+            h2_frame(conn, 0x4, 0x0, 0, NULL, 0);
+            conn->settings_sent = true;
+        }
+    }
+    
+    while (conn->in_len - pos >= 9) {
+        const unsigned char *f = (const unsigned char *)conn->in + pos;
+        size_t len = (size_t)f[0] << 16 | (size_t)f[1] << 8 | f[2];
+        if (conn->in_len - pos < 9 + len) break;
+        uint8_t type = f[3];
+        uint8_t flags = f[4];
+        uint32_t stream = read_be32(f + 5) & 0x7fffffff;
+        
+        if (type == 0x4 && !(flags & 0x1)) {
+            h2_frame(conn, 0x4, 0x1, 0, NULL, 0);       // SETTINGS ack
+        } else if (type == 0x6 && !(flags & 0x1)) {
+            h2_frame(conn, 0x6, 0x1, 0, f + 9, len);    // PING ack
+        } else if ((type == 0x1 || type == 0x9) && (flags & 0x4)) {
+            mock_enqueue(server, id, stream, true);     // HEADERS/CONTINUATION with END_HEADERS
+        }
+        pos += 9 + len;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+}
+
+void mock_read(mock_server_t *server, int id) {
+    mock_conn_t *conn = &server->conns[id];
+    char chunk[MOCK_READ_CHUNK];
+    for (;;) {
+        ssize_t n = read(conn->fd, chunk, sizeof(chunk));
+        if (n > 0) {
+            buffer_append(&conn->in, &conn->in_len, &conn->in_capacity, chunk, (size_t)n);
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            mock_close(server, id);
+            return;
+        }
+        if (errno == EAGAIN) break;
+    }
+    
+    if (!conn->h2 && !conn->preface_done && conn->in_len >= 3 && memcmp(conn->in, "PRI", 3) == 0) {
+        conn->h2 = true;
+    }
+    if (!conn->h2) mock_parse_h1(server, id);
+    if (conn->h2) mock_parse_h2(server, id);
+}
+
+void mock_flush(mock_server_t *server, int id) {
+    mock_conn_t *conn = &server->conns[id];
+    size_t sent = 0;
+    while (sent < conn->out_len) {
+        ssize_t n = write(conn->fd, conn->out + sent, conn->out_len - sent);
+        if (n > 0) {
+            sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            break;
+        } else {
+            mock_close(server, id);
+            return;
+        }
+    }
+    memmove(conn->out, conn->out + sent, conn->out_len - sent);
+    conn->out_len -= sent;
+}
+
+void *mock_server_run(void *arg) {
+    mock_server_t *server = (mock_server_t *)arg;
+    struct pollfd *fds = malloc((MOCK_MAX_CONNECTIONS + 1) * sizeof(struct pollfd));
+    int *ids = malloc((MOCK_MAX_CONNECTIONS + 1) * sizeof(int));
+    
+    while (!server->stop) {
+        // Send every response whose latency has elapsed
+        double now = monotonic_seconds();
+        while (server->queue_len > 0 && server->queue[server->queue_head].due <= now) {
+            mock_respond(server, &server->queue[server->queue_head]);
+            server->queue_head++;
+            server->queue_len--;
+        }
+        
+        int nfds = 0;
+        fds[nfds].fd = server->listen_fd;
+        fds[nfds].events = POLLIN;
+        ids[nfds++] = -1;
+        for (int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+            mock_conn_t *conn = &server->conns[i];
+            if (conn->fd < 0) continue;
+            if (conn->out_len > 0) mock_flush(server, i);
+            if (conn->fd < 0) continue;
+            fds[nfds].fd = conn->fd;
+            fds[nfds].events = POLLIN | (conn->out_len > 0 ? POLLOUT : 0);
+            ids[nfds++] = i;
+        }
+        
+        int timeout_ms = 50;
+        if (server->queue_len > 0) {
+            double wait = server->queue[server->queue_head].due - monotonic_seconds();
+            timeout_ms = wait <= 0 ? 0 : (int)(wait * 1000) + 1;
+            if (timeout_ms > 50) timeout_ms = 50;
+        }
+        if (poll(fds, nfds, timeout_ms) <= 0) continue;
+        
+        for (int k = 1; k < nfds; k++) {
+            if (fds[k].revents & (POLLIN | POLLHUP | POLLERR)) mock_read(server, ids[k]);
+        }
+        if (fds[0].revents & POLLIN) {
+            for (;;) {
+                int fd = accept(server->listen_fd, NULL, NULL);
+                if (fd < 0) break;
+                int slot = -1;
+                for (int i = 0; i < MOCK_MAX_CONNECTIONS && slot < 0; i++) {
+                    if (server->conns[i].fd < 0) slot = i;
+                }
+                if (slot < 0) {
+                    close(fd);
+                    continue;
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                mock_conn_t *conn = &server->conns[slot];
+                conn->fd = fd;
+                conn->h2 = false;
+                conn->preface_done = false;
+                conn->settings_sent = false;
+                conn->in_len = 0;
+                conn->out_len = 0;
+            }
+        }
+    }
+    
+    free(fds);
+    free(ids);
+    return NULL;
+}
+
+bool mock_server_start(mock_server_t *server, const mock_config_t *config) {
+    memset(server, 0, sizeof(*server));
+    server->config = *config;
+    for (int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+        server->conns[i].fd = -1;
+    }
+    
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) return false;
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 1024) != 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        close(server->listen_fd);
+        return false;
+    }
+    server->port = ntohs(addr.sin_port);
+    fcntl(server->listen_fd, F_SETFL, fcntl(server->listen_fd, F_GETFL) | O_NONBLOCK);
+    
+    if (pthread_create(&server->thread, NULL, mock_server_run, server) != 0) {
+        close(server->listen_fd);
+        return false;
+    }
+    return true;
+}
+
+void mock_server_stop(mock_server_t *server) {
+    server->stop = true;
+    pthread_join(server->thread, NULL);
+    for (int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+        if (server->conns[i].fd >= 0) close(server->conns[i].fd);
+        free(server->conns[i].in);
+        free(server->conns[i].out);
+    }
+    free(server->queue);
+    close(server->listen_fd);
+}
+
+// Run lkvad's main() in-process with its stdout silenced; returns elapsed seconds or -1
+double bench_run_lkvad(char **args) {
+    int argc = 0;
+    while (args[argc]) argc++;
+    
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    
+    optind = 0;  // reinitialize getopt for each run
+    double t0 = monotonic_seconds();
+    int rc = lkvad_main(argc, args);
+    double elapsed = monotonic_seconds() - t0;
+    
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return rc == 0 ? elapsed : -1;
+}
+
+// Count lines of a plain playlist, i.e. the entries that passed verification
+long count_lines(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long lines = 0;
+    int c;
+    while ((c = getc(f)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(f);
+    return lines;
+}
+
+long long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+void bench_report(FILE *out, const char *line) {
+    fputs(line, out);
+    fputc('\n', out);
+    fflush(out);
+    printf("%s\n", line);
+}
+
+void bench_generate(FILE *out, const char *path, int max_entries) {
+    static const char *const formats[] = {"plain", "m3u", "pls", "xspf"};
+    static const char *const gen_threads[] = {"1", "4"};
+    
+    for (int entries = 1000; entries > 0 && entries <= max_entries; entries = entries > INT_MAX / 10 ? 0 : entries * 10) {
+        char end[16];
+        snprintf(end, sizeof(end), "%d", entries);
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            for (size_t t = 0; t < sizeof(gen_threads) / sizeof(gen_threads[0]); t++) {
+                char *args[] = {"lkvad", "-l", "http://cdn.example.com/series/episode_*.mp4", "-s", "1",
+                                "-e", end, "-p", (char *)path, "-f", (char *)formats[f], "-z", "7",
+                                "--gen-threads", (char *)gen_threads[t], NULL};
+                double seconds = bench_run_lkvad(args);
+                long long bytes = file_size(path);
+                char line[256];
+                snprintf(line, sizeof(line),
+                         "bench=generate format=%s gen_threads=%s entries=%d seconds=%.6f entries_per_sec=%.0f mb_per_sec=%.1f%s",
+                         formats[f], gen_threads[t], entries, seconds,
+                         seconds > 0 ? entries / seconds : 0, seconds > 0 ? bytes / seconds / 1e6 : 0,
+                         seconds < 0 ? " error=1" : "");
+                bench_report(out, line);
+            }
+        }
+    }
+}
+
+void bench_probe(FILE *out, const char *path, int max_probes, const mock_config_t *mock) {
+    mock_server_t server;
+    if (!mock_server_start(&server, mock)) {
+        fprintf(stderr, "Error: Failed to start the mock server.\n");
+        return;
+    }
+    
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/track_*.mp3", server.port);
+    
+    // engine name, protocol, extra arguments
+    static const char *const variants[][5] = {
+        {"threads", "http1.1", "-t", "16", NULL},
+        {"multi", "http1.1", "--max-inflight", "64", NULL},
+        {"multi", "http2", "--http2-cleartext", NULL, NULL},
+        {"multi", "http2", "--http2-cleartext", "--max-inflight", "1000"},
+    };
+    
+    for (int entries = 1000; entries > 0 && entries <= max_probes; entries = entries > INT_MAX / 10 ? 0 : entries * 10) {
+        char end[16];
+        snprintf(end, sizeof(end), "%d", entries);
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            char *args[16] = {"lkvad", "-l", url, "-s", "1", "-e", end, "-p", (char *)path, "-v"};
+            int argc = 10;
+            for (int k = 2; k < 5 && variants[v][k]; k++) args[argc++] = (char *)variants[v][k];
+            args[argc] = NULL;
+            
+            double seconds = bench_run_lkvad(args);
+            long valid = count_lines(path);
+            char options[64] = "";
+            for (int k = 2; k < 5 && variants[v][k]; k++) {
+                strncat(options, variants[v][k], sizeof(options) - strlen(options) - 2);
+                if (k < 4 && variants[v][k + 1]) strcat(options, ",");
+            }
+            char line[320];
+            snprintf(line, sizeof(line),
+                     "bench=probe engine=%s protocol=%s options=%s entries=%d latency_ms=%.1f failure_rate=%.3f "
+                     "seconds=%.6f probes_per_sec=%.0f valid=%ld%s",
+                     variants[v][0], variants[v][1], options, entries, mock->latency * 1e3, mock->failure_rate,
+                     seconds, seconds > 0 ? entries / seconds : 0, valid, seconds < 0 ? " error=1" : "");
+            bench_report(out, line);
+        }
+    }
+    mock_server_stop(&server);
+}
+
+int main(int argc, char *argv[]) {
+    int max_entries = 10000000;
+    int max_probes = 10000;
+    mock_config_t mock = {.latency = 0.002, .failure_rate = 0.05};
+    const char *output = "bench_output.txt";
+    
+    static const struct option bench_options[] = {
+        {"max-entries", required_argument, NULL, 'e'},
+        {"max-probes", required_argument, NULL, 'n'},
+        {"latency-ms", required_argument, NULL, 'l'},
+        {"failure-rate", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", bench_options, NULL)) != -1) {
+        switch (opt) {
+            case 'e': max_entries = atoi(optarg); break;
+            case 'n': max_probes = atoi(optarg); break;
+            case 'l': mock.latency = atof(optarg) / 1e3; break;
+            case 'f': mock.failure_rate = atof(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [--max-entries n] [--max-probes n] [--latency-ms ms] "
+                        "[--failure-rate r] [--output file]\n", argv[0]);
+                return 1;
+        }
+    }
+    
+    FILE *out = fopen(output, "a");
+    if (!out) {
+        perror("Error opening output file");
+        return 1;
+    }
+    
+    char path[] = "/tmp/lkvad_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Error creating playlist file");
+        fclose(out);
+        return 1;
+    }
+    close(fd);
+    
+    char line[128];
+    snprintf(line, sizeof(line), "bench=run time=%lld curl=%s cpus=%ld",
+             (long long)time(NULL), curl_version_info(CURLVERSION_NOW)->version, sysconf(_SC_NPROCESSORS_ONLN));
+    bench_report(out, line);
+    
+    bench_generate(out, path, max_entries);
+    bench_probe(out, path, max_probes, &mock);
+    
+    unlink(path);
+    fclose(out);
+    return 0;
+}
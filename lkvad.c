@@ -2,14 +2,78 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <time.h>
+#include <limits.h>
 #include <curl/curl.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+// --compress links zlib for gzip (-lz); zstd is built in with -DHAVE_ZSTD -lzstd
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXT_SCAN_X86
+#endif
 
 #define MAX_URL_LENGTH 2048
+#define WRITER_BUFFER_SIZE (1 << 20)
+#define GEN_CHUNK_ENTRIES 65536
+#define TEMPLATE_MAX_DIMS 8
 #define DEFAULT_TIMEOUT 5
+#define DEFAULT_HTTP2_INFLIGHT 100
+#define DEFAULT_HTTP2_HOST_CONNECTIONS 2
+#define DEFAULT_CACHE_TTL 86400
+#define CACHE_MAGIC "LKVC"
+#define CACHE_VERSION 2
+#define CACHE_INITIAL_CAPACITY 1024
+#define CACHE_ETAG_LENGTH 64
+#define CACHE_DATE_LENGTH 40
+#define INDEX_INITIAL_CAPACITY 4096
+#define INDEX_FETCH_TIMEOUT 120    // seconds allowed per --index-source page
+#define INDEX_MAX_PAGES 10000      // S3 listing pages followed before the rest is left to probes
+#define JOURNAL_MAGIC "LKVJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_SYNC_ENTRIES 256   // journal records between fdatasync calls
+#define SHARD_MAGIC "LKVS"
+#define SHARD_VERSION 2
+#define SHARD_STOPPED 1            // shard_header_t flag: --stop-after-misses ended the block early
+#define SERVE_REQUEST_MAX 8192     // bytes of a --serve request line
+#define SERVE_BACKLOG 64
+#define SERVE_CLIENT_TIMEOUT 30    // seconds a --serve client may stall reading or writing
+#define MEDIA_TYPE_LENGTH 64
+#define MEDIA_TITLE_LENGTH 64
+#define MEDIA_ARTIST_LENGTH 48
+#define MAX_SNIFF_BYTES (1 << 20)
+#define ADAPTIVE_INITIAL_LIMIT 2
+#define ADAPTIVE_LATENCY_TOLERANCE 3.0  // smoothed latency over its floor that stops growth
+#define DEFAULT_MAX_RETRIES 3
+#define DEFAULT_EVENTS_FD 3
+#define PROGRESS_INTERVAL_MS 200
+#define PROGRESS_STRIDE 1024       // unverified entries between clock reads for progress
+#define MAX_RETRY_AFTER 300
+#define AUTO_TRUST_HEAD_AFTER 16  // range GETs agreeing with HEAD before ordinary HEAD failures are trusted
+#define LATENCY_SUB_BUCKETS 16     // histogram buckets per power of two, about 6% resolution
+#define LATENCY_BUCKETS ((40 - 3) * LATENCY_SUB_BUCKETS)  // microseconds up to 2^40
+#define MAX_STATUS_CODE 600
+#define ENTRY_MAX_SEGMENTS 8       // literal + slot pairs in a compiled entry layout
+#define ENTRY_MEDIA_BOUND 1024     // bytes a title or XSPF media slot can expand to
+#define TEXT_SCAN_SET 5            // characters a text_scan set holds
+#define PLS_COUNT_WIDTH 10         // digits reserved for a NumberOfEntries filled in after verification
+#define VERIFY_WINDOW_PER_SLOT 16  // reorder window entries per thread or in-flight slot
+#define JOBS_MAX_ACTIVE 8          // --jobs playlists open and probed at once
+#define JOB_QUANTUM 32             // entries a job hands out before the next job's turn
 
 typedef enum {
     FORMAT_PLAIN,
@@ -19,9 +83,23 @@ typedef enum {
     FORMAT_XSPF
 } playlist_format_t;
 
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+} output_compression_t;
+
+typedef enum {
+    PROBE_HEAD,
+    PROBE_RANGE,
+    PROBE_AUTO
+} probe_strategy_t;
+
 typedef struct {
     char *link_template;
     char *playlist_file;
+    int output_fd;                // -p -: the original stdout, -1 for a file
+    output_compression_t compress;
     int start;
     int end;
     int padding;
@@ -29,157 +107,5363 @@ typedef struct {
     bool verify_urls;
     bool verbose;
     int threads;
+    int max_inflight;
+    bool http2;
+    bool http2_cleartext;
+    int max_host_connections;
+    bool discover;
+    int discover_gap;
+    char *cache_file;
+    int cache_ttl;
+    char *index_source;           // --index-source: listing that answers probes for the URLs it covers
+    bool incremental;
+    int gen_threads;
+    bool adaptive;
+    int max_retries;
+    double timeout;
+    double connect_timeout;
+    int low_speed_time;
+    int breaker_threshold;
+    probe_strategy_t probe_strategy;
+    int sniff_bytes;
+    int stop_after_misses;
+    bool stats;
+    char *stats_json;
+    char *jobs_file;
+    bool events;                  // --events ndjson
+    int events_fd;
+    bool journal;                 // keep a checkpoint journal next to each output
+    bool resume;                  // replay the journal of an interrupted run first
+    int shard;                    // --shard K/N: verify block K of N, 0 for the whole range
+    int shards;
+    char *serve_socket;           // --serve: UNIX socket to answer playlist requests on
     char *prefix_text;
     char *suffix_text;
 } config_t;
 
+// Long-only options
+enum {
+    OPT_MAX_INFLIGHT = 256,
+    OPT_HTTP2,
+    OPT_HTTP2_CLEARTEXT,
+    OPT_MAX_HOST_CONNECTIONS,
+    OPT_DISCOVER,
+    OPT_DISCOVER_GAP,
+    OPT_CACHE,
+    OPT_CACHE_TTL,
+    OPT_INDEX_SOURCE,
+    OPT_INCREMENTAL,
+    OPT_GEN_THREADS,
+    OPT_ADAPTIVE,
+    OPT_MAX_RETRIES,
+    OPT_TIMEOUT,
+    OPT_CONNECT_TIMEOUT,
+    OPT_LOW_SPEED_TIME,
+    OPT_BREAKER,
+    OPT_PROBE,
+    OPT_SNIFF,
+    OPT_STOP_AFTER_MISSES,
+    OPT_STATS,
+    OPT_STATS_JSON,
+    OPT_JOBS,
+    OPT_COMPRESS,
+    OPT_EVENTS,
+    OPT_EVENTS_FD,
+    OPT_JOURNAL,
+    OPT_RESUME,
+    OPT_SHARD,
+    OPT_SERVE
+};
+
+static const struct option long_options[] = {
+    {"max-inflight", required_argument, NULL, OPT_MAX_INFLIGHT},
+    {"http2", no_argument, NULL, OPT_HTTP2},
+    {"http2-cleartext", no_argument, NULL, OPT_HTTP2_CLEARTEXT},
+    {"max-host-connections", required_argument, NULL, OPT_MAX_HOST_CONNECTIONS},
+    {"discover", no_argument, NULL, OPT_DISCOVER},
+    {"discover-gap", required_argument, NULL, OPT_DISCOVER_GAP},
+    {"cache", required_argument, NULL, OPT_CACHE},
+    {"cache-ttl", required_argument, NULL, OPT_CACHE_TTL},
+    {"index-source", required_argument, NULL, OPT_INDEX_SOURCE},
+    {"incremental", no_argument, NULL, OPT_INCREMENTAL},
+    {"gen-threads", required_argument, NULL, OPT_GEN_THREADS},
+    {"adaptive", no_argument, NULL, OPT_ADAPTIVE},
+    {"max-retries", required_argument, NULL, OPT_MAX_RETRIES},
+    {"timeout", required_argument, NULL, OPT_TIMEOUT},
+    {"connect-timeout", required_argument, NULL, OPT_CONNECT_TIMEOUT},
+    {"low-speed-time", required_argument, NULL, OPT_LOW_SPEED_TIME},
+    {"breaker", required_argument, NULL, OPT_BREAKER},
+    {"probe", required_argument, NULL, OPT_PROBE},
+    {"sniff", required_argument, NULL, OPT_SNIFF},
+    {"stop-after-misses", required_argument, NULL, OPT_STOP_AFTER_MISSES},
+    {"stats", no_argument, NULL, OPT_STATS},
+    {"stats-json", required_argument, NULL, OPT_STATS_JSON},
+    {"jobs", required_argument, NULL, OPT_JOBS},
+    {"compress", required_argument, NULL, OPT_COMPRESS},
+    {"events", required_argument, NULL, OPT_EVENTS},
+    {"events-fd", required_argument, NULL, OPT_EVENTS_FD},
+    {"journal", no_argument, NULL, OPT_JOURNAL},
+    {"resume", no_argument, NULL, OPT_RESUME},
+    {"shard", required_argument, NULL, OPT_SHARD},
+    {"serve", required_argument, NULL, OPT_SERVE},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+// What a probe learned about the media behind a URL
+typedef struct {
+    long long content_length;     // full size of the resource, -1 if unknown
+    char content_type[MEDIA_TYPE_LENGTH];
+    int duration_ms;              // -1 if unknown
+    char title[MEDIA_TITLE_LENGTH];
+    char artist[MEDIA_ARTIST_LENGTH];
+} media_info_t;
+
 typedef struct {
     char *url;
     bool is_valid;
     int index;
+    long status;                  // HTTP status of the final response, 0 if none
+    long long latency_us;         // time spent in requests, summed over retries
+    char etag[CACHE_ETAG_LENGTH];
+    char last_modified[CACHE_DATE_LENGTH];
+    bool from_cache;              // answered by a fresh cache entry, no request sent
+    bool revalidating;            // conditional request sent for a stale cache entry
+    bool cached_valid;
+    struct curl_slist *headers;
+    long retry_after;             // seconds from a Retry-After header, -1 if none
+    int attempts;                 // probes already spent on throttled answers
+    bool retry;                   // probe again: throttled, or HEAD fell back to a range GET
+    bool fallback;                // the pending retry is a range GET fallback, no backoff
+    double retry_at;              // event loop: monotonic time the pending retry is due
+    bool range_probe;             // current probe is a Range: bytes=0-0 GET
+    bool body_aborted;            // write_callback cut the body off on purpose
+    long head_status;             // status of the HEAD that preceded a fallback
+    bool skipped;                 // failed fast because the circuit breaker is open
+    bool done;                    // result available to the consumer
+    bool cancelled;               // result no longer wanted: skip the probe or abort it in flight
+    media_info_t media;
+    unsigned char *sniff;         // --sniff: leading bytes of the body, NULL otherwise
+    size_t sniff_len;
+    size_t sniff_capacity;
 } url_check_t;
 
-// CURL write callback to discard data
+// CURL write callback for range probes: the status line and headers have
+// answered the probe once body bytes arrive, so abort the transfer there,
+// or once the --sniff buffer is full
 size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
-    return size * nmemb;
+    url_check_t *check = (url_check_t *)userp;
+    size_t len = size * nmemb;
+    if (!check || !check->range_probe || len == 0) return len;
+    
+    if (check->sniff) {
+        size_t room = check->sniff_capacity - check->sniff_len;
+        size_t n = len < room ? len : room;
+        memcpy(check->sniff + check->sniff_len, contents, n);
+        check->sniff_len += n;
+        if (n == len) return len;
+    }
+    check->body_aborted = true;
+    return 0;
+}
+
+// CURL progress callback for --stop-after-misses: abort a probe whose
+// result the consumer has given up on. cancelled is set by the consuming
+// thread while the probe may be running on a worker.
+int cancel_callback(void *userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal;
+    (void)dlnow;
+    (void)ultotal;
+    (void)ulnow;
+    url_check_t *check = (url_check_t *)userp;
+    return __atomic_load_n(&check->cancelled, __ATOMIC_RELAXED) ? 1 : 0;
+}
+
+// Copy a header value, trimmed of surrounding whitespace, into dst
+void copy_header_value(char *dst, size_t dst_size, const char *value, size_t len) {
+    while (len > 0 && isspace((unsigned char)*value)) {
+        value++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    // Values that do not fit would not match on revalidation, so drop them
+    if (len >= dst_size) len = 0;
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+// CURL header callback recording the validators of the final response
+size_t header_callback(char *buffer, size_t size, size_t nitems, void *userp) {
+    url_check_t *check = (url_check_t *)userp;
+    size_t len = size * nitems;
+    
+    // A new status line starts a new response (after a redirect)
+    if (len >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        check->etag[0] = '\0';
+        check->last_modified[0] = '\0';
+        check->retry_after = -1;
+        check->media.content_length = -1;
+        check->sniff_len = 0;
+    } else if (len > 15 && strncasecmp(buffer, "Content-Length:", 15) == 0) {
+        // A Content-Range total below wins for 206 answers to range probes
+        if (check->media.content_length < 0) {
+            check->media.content_length = strtoll(buffer + 15, NULL, 10);
+        }
+    } else if (len > 14 && strncasecmp(buffer, "Content-Range:", 14) == 0) {
+        const char *total = memchr(buffer, '/', len);
+        if (total && isdigit((unsigned char)total[1])) {
+            check->media.content_length = strtoll(total + 1, NULL, 10);
+        }
+    } else if (len > 12 && strncasecmp(buffer, "Retry-After:", 12) == 0) {
+        char value[CACHE_DATE_LENGTH];
+        copy_header_value(value, sizeof(value), buffer + 12, len - 12);
+        if (isdigit((unsigned char)value[0])) {
+            check->retry_after = atol(value);
+        } else if (value[0]) {
+            // HTTP-date form
+            time_t when = curl_getdate(value, NULL);
+            if (when > 0) check->retry_after = when > time(NULL) ? (long)(when - time(NULL)) : 0;
+        }
+    } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        copy_header_value(check->etag, sizeof(check->etag), buffer + 5, len - 5);
+    } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        copy_header_value(check->last_modified, sizeof(check->last_modified), buffer + 14, len - 14);
+    }
+    return len;
+}
+
+void media_info_reset(media_info_t *media) {
+    media->content_length = -1;
+    media->content_type[0] = '\0';
+    media->duration_ms = -1;
+    media->title[0] = '\0';
+    media->artist[0] = '\0';
+}
+
+// Append code point cp to dst as UTF-8 if it fits in the remaining space
+void media_put_utf8(char *dst, size_t dst_size, size_t *len, uint32_t cp) {
+    char bytes[4];
+    size_t n;
+    if (cp < 0x20 || cp == 0x7f) cp = ' ';  // keep titles on one playlist line
+    if (cp < 0x80) {
+        bytes[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = (char)(0xc0 | (cp >> 6));
+        bytes[1] = (char)(0x80 | (cp & 0x3f));
+        n = 2;
+    } else if (cp < 0x10000) {
+        bytes[0] = (char)(0xe0 | (cp >> 12));
+        bytes[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        bytes[2] = (char)(0x80 | (cp & 0x3f));
+        n = 3;
+    } else {
+        bytes[0] = (char)(0xf0 | (cp >> 18));
+        bytes[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+        bytes[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        bytes[3] = (char)(0x80 | (cp & 0x3f));
+        n = 4;
+    }
+    if (*len + n >= dst_size) return;
+    memcpy(dst + *len, bytes, n);
+    *len += n;
+}
+
+// Decode tag text into NUL-terminated UTF-8. encoding follows ID3v2:
+// 0 ISO-8859-1, 1 UTF-16 with BOM, 2 UTF-16BE, 3 UTF-8.
+void media_copy_text(char *dst, size_t dst_size, int encoding, const unsigned char *src, size_t n) {
+    size_t len = 0;
+    if (encoding == 1 || encoding == 2) {
+        bool big_endian = true;
+        if (encoding == 1 && n >= 2) {
+            big_endian = !(src[0] == 0xff && src[1] == 0xfe);
+            if ((src[0] == 0xff && src[1] == 0xfe) || (src[0] == 0xfe && src[1] == 0xff)) {
+                src += 2;
+                n -= 2;
+            }
+        }
+        for (size_t i = 0; i + 1 < n; i += 2) {
+            uint32_t unit = big_endian ? (uint32_t)(src[i] << 8 | src[i + 1]) : (uint32_t)(src[i + 1] << 8 | src[i]);
+            if (unit == 0) break;
+            if (unit >= 0xd800 && unit < 0xdc00 && i + 3 < n) {
+                uint32_t low = big_endian ? (uint32_t)(src[i + 2] << 8 | src[i + 3]) : (uint32_t)(src[i + 3] << 8 | src[i + 2]);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                    i += 2;
+                }
+            }
+            media_put_utf8(dst, dst_size, &len, unit);
+        }
+    } else {
+        for (size_t i = 0; i < n && src[i]; i++) {
+            if (encoding == 3 && src[i] >= 0x80) {
+                // Copy whole UTF-8 sequences so truncation never splits one
+                size_t seq = src[i] >= 0xf0 ? 4 : src[i] >= 0xe0 ? 3 : src[i] >= 0xc0 ? 2 : 1;
+                if (i + seq > n || len + seq >= dst_size) break;
+                memcpy(dst + len, src + i, seq);
+                len += seq;
+                i += seq - 1;
+            } else {
+                media_put_utf8(dst, dst_size, &len, src[i]);
+            }
+        }
+    }
+    while (len > 0 && dst[len - 1] == ' ') len--;
+    dst[len] = '\0';
+}
+
+uint32_t read_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+uint32_t read_syncsafe32(const unsigned char *p) {
+    return (uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14 |
+           (uint32_t)(p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+// Parse the frames of an ID3v2 tag for title, artist and TLEN. Returns the
+// offset of the audio that follows the tag.
+size_t media_parse_id3(media_info_t *media, const unsigned char *data, size_t len) {
+    int version = data[3];
+    int flags = data[5];
+    size_t end = 10 + read_syncsafe32(data + 6);
+    size_t audio = end + ((flags & 0x10) ? 10 : 0);
+    if (version < 2 || version > 4 || (flags & 0x80)) return audio;  // unsynchronised tags are not parsed
+    
+    size_t pos = 10;
+    if ((flags & 0x40) && version >= 3 && len >= 14) {
+        size_t ext = version == 4 ? read_syncsafe32(data + 10) : read_be32(data + 10) + 4;
+        pos += ext;
+    }
+    size_t header_len = version == 2 ? 6 : 10;
+    if (end > len) end = len;
+    
+    while (pos + header_len <= end && data[pos] != 0) {
+        const unsigned char *frame = data + pos;
+        size_t size;
+        if (version == 2) {
+            size = (size_t)frame[3] << 16 | (size_t)frame[4] << 8 | frame[5];
+        } else if (version == 4) {
+            size = read_syncsafe32(frame + 4);
+        } else {
+            size = read_be32(frame + 4);
+        }
+        if (size == 0 || pos + header_len + size > end) break;
+        
+        const unsigned char *body = frame + header_len;
+        bool is_title = version == 2 ? memcmp(frame, "TT2", 3) == 0 : memcmp(frame, "TIT2", 4) == 0;
+        bool is_artist = version == 2 ? memcmp(frame, "TP1", 3) == 0 : memcmp(frame, "TPE1", 4) == 0;
+        bool is_length = version == 2 ? memcmp(frame, "TLE", 3) == 0 : memcmp(frame, "TLEN", 4) == 0;
+        if (is_title) {
+            media_copy_text(media->title, sizeof(media->title), body[0], body + 1, size - 1);
+        } else if (is_artist) {
+            media_copy_text(media->artist, sizeof(media->artist), body[0], body + 1, size - 1);
+        } else if (is_length) {
+            char ms[16];
+            media_copy_text(ms, sizeof(ms), body[0], body + 1, size - 1);
+            if (isdigit((unsigned char)ms[0])) media->duration_ms = atoi(ms);
+        }
+        pos += header_len + size;
+    }
+    return audio;
+}
+
+// Fields of an MPEG audio frame header
+typedef struct {
+    int bitrate_kbps;
+    int sample_rate;
+    int samples_per_frame;
+    int frame_length;
+    size_t side_info;             // Layer III side information bytes after the header
+} mpeg_frame_t;
+
+bool mpeg_parse_frame(const unsigned char *p, mpeg_frame_t *frame) {
+    static const int bitrates[2][3][15] = {
+        {   // MPEG-1: Layer I, II, III
+            {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+            {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}
+        },
+        {   // MPEG-2 and 2.5
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+        }
+    };
+    static const int sample_rates[3] = {44100, 48000, 32000};
+    
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) return false;
+    int version = (p[1] >> 3) & 3;    // 0 MPEG-2.5, 2 MPEG-2, 3 MPEG-1
+    int layer = 4 - ((p[1] >> 1) & 3);
+    int bitrate_index = p[2] >> 4;
+    int rate_index = (p[2] >> 2) & 3;
+    if (version == 1 || layer == 4 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+    
+    bool mpeg1 = version == 3;
+    bool mono = (p[3] >> 6) == 3;
+    int padding = (p[2] >> 1) & 1;
+    frame->bitrate_kbps = bitrates[mpeg1 ? 0 : 1][layer - 1][bitrate_index];
+    frame->sample_rate = sample_rates[rate_index] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+    frame->samples_per_frame = layer == 1 ? 384 : (layer == 3 && !mpeg1) ? 576 : 1152;
+    if (layer == 1) {
+        frame->frame_length = (12 * frame->bitrate_kbps * 1000 / frame->sample_rate + padding) * 4;
+    } else {
+        frame->frame_length = frame->samples_per_frame / 8 * frame->bitrate_kbps * 1000 /
+                              frame->sample_rate + padding;
+    }
+    frame->side_info = layer != 3 ? 0 : mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    return frame->frame_length > 4;
+}
+
+// Duration of an MPEG audio stream starting at offset: the frame count of a
+// Xing/Info or VBRI header when present, otherwise the constant bitrate
+void media_parse_mpeg(media_info_t *media, const unsigned char *data, size_t len, size_t offset) {
+    mpeg_frame_t frame;
+    size_t pos = offset;
+    
+    // Skip junk before the first frame, requiring the next header to match as well
+    for (; pos + 4 <= len; pos++) {
+        if (!mpeg_parse_frame(data + pos, &frame)) continue;
+        mpeg_frame_t next;
+        size_t next_pos = pos + (size_t)frame.frame_length;
+        if (next_pos + 4 > len || mpeg_parse_frame(data + next_pos, &next)) break;
+    }
+    if (pos + 4 > len) return;
+    
+    const unsigned char *p = data + pos;
+    long long frames = -1;
+    size_t xing = 4 + frame.side_info;
+    if (frame.side_info && pos + xing + 12 <= len &&
+        (memcmp(p + xing, "Xing", 4) == 0 || memcmp(p + xing, "Info", 4) == 0)) {
+        if (read_be32(p + xing + 4) & 1) frames = read_be32(p + xing + 8);
+    } else if (pos + 36 + 18 <= len && memcmp(p + 36, "VBRI", 4) == 0) {
+        frames = read_be32(p + 36 + 14);
+    }
+    
+    if (frames > 0) {
+        media->duration_ms = (int)(frames * frame.samples_per_frame * 1000 / frame.sample_rate);
+    } else if (media->content_length > (long long)pos) {
+        media->duration_ms = (int)((media->content_length - (long long)pos) * 8 / frame.bitrate_kbps);
+    }
+}
+
+// Walk MP4 boxes in data[start, end) for the movie header duration and the
+// iTunes-style title and artist. Boxes cut off by the sniff are parsed as far as they go.
+void media_parse_mp4(media_info_t *media, const unsigned char *data, size_t start, size_t end, int depth) {
+    size_t pos = start;
+    while (pos + 8 <= end && depth < 8) {
+        uint64_t size = read_be32(data + pos);
+        const unsigned char *type = data + pos + 4;
+        size_t header = 8;
+        if (size == 1) {
+            if (pos + 16 > end) return;
+            size = (uint64_t)read_be32(data + pos + 8) << 32 | read_be32(data + pos + 12);
+            header = 16;
+        } else if (size == 0) {
+            size = end - pos;
+        }
+        if (size < header) return;
+        size_t box_end = size > end - pos ? end : pos + (size_t)size;
+        const unsigned char *body = data + pos + header;
+        size_t body_len = box_end - pos - header;
+        
+        if (memcmp(type, "moov", 4) == 0 || memcmp(type, "udta", 4) == 0 || memcmp(type, "ilst", 4) == 0) {
+            media_parse_mp4(media, data, pos + header, box_end, depth + 1);
+        } else if (memcmp(type, "meta", 4) == 0 && body_len >= 4) {
+            media_parse_mp4(media, data, pos + header + 4, box_end, depth + 1);  // full box
+        } else if (memcmp(type, "mvhd", 4) == 0 && body_len >= 20) {
+            int version = body[0];
+            if (version == 1 && body_len >= 32) {
+                uint32_t timescale = read_be32(body + 20);
+                uint64_t duration = (uint64_t)read_be32(body + 24) << 32 | read_be32(body + 28);
+                if (timescale) media->duration_ms = (int)(duration * 1000 / timescale);
+            } else if (version == 0) {
+                uint32_t timescale = read_be32(body + 12);
+                uint32_t duration = read_be32(body + 16);
+                if (timescale) media->duration_ms = (int)((uint64_t)duration * 1000 / timescale);
+            }
+        } else if ((memcmp(type, "\xa9nam", 4) == 0 || memcmp(type, "\xa9" "ART", 4) == 0) &&
+                   body_len >= 16 && memcmp(body + 4, "data", 4) == 0) {
+            // data box: size, "data", type, locale, then UTF-8 text
+            size_t text_len = read_be32(body);
+            if (text_len > body_len) text_len = body_len;
+            if (text_len >= 16) {
+                bool title = type[1] == 'n';
+                media_copy_text(title ? media->title : media->artist,
+                                title ? sizeof(media->title) : sizeof(media->artist),
+                                3, body + 16, text_len - 16);
+            }
+        }
+        if (box_end == end) return;
+        pos = box_end;
+    }
+}
+
+// Fill media from the leading bytes of a resource fetched by --sniff
+void media_sniff(media_info_t *media, const unsigned char *data, size_t len) {
+    if (len >= 12 && memcmp(data + 4, "ftyp", 4) == 0) {
+        media_parse_mp4(media, data, 0, len, 0);
+    } else if (len >= 10 && memcmp(data, "ID3", 3) == 0) {
+        int tag_duration = media->duration_ms;
+        size_t audio = media_parse_id3(media, data, len);
+        if (media->duration_ms == tag_duration) media_parse_mpeg(media, data, len, audio);
+    } else if (len >= 4 && (strncasecmp(media->content_type, "audio/mpeg", 10) == 0 ||
+                            (data[0] == 0xff && (data[1] & 0xe0) == 0xe0))) {
+        media_parse_mpeg(media, data, len, 0);
+    }
+}
+
+// Configure an easy handle for a HEAD probe of url
+void setup_probe(CURL *curl, const config_t *config, const char *url) {
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_RANGE, NULL);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)(config->timeout * 1000));
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)(config->connect_timeout * 1000));
+    if (config->low_speed_time > 0) {
+        // Abort probes that stall below 1 byte/s for low_speed_time seconds
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)config->low_speed_time);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    if (config->http2) {
+        // Wait for an existing connection to offer a free stream rather than opening a new one
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, config->http2_cleartext ?
+                         (long)CURL_HTTP_VERSION_2_0 : (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+}
+
+// Decide whether a finished probe means the URL is accessible
+bool probe_succeeded(CURL *curl, CURLcode res) {
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    return (res == CURLE_OK && response_code >= 200 && response_code < 400);
+}
+
+// Share object so probes reuse DNS results, TLS sessions and, when used
+// from a single thread, open connections
+typedef struct {
+    CURLSH *share;
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+} probe_share_t;
+
+void probe_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    probe_share_t *ps = (probe_share_t *)userptr;
+    pthread_mutex_lock(&ps->locks[data]);
+}
+
+void probe_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    probe_share_t *ps = (probe_share_t *)userptr;
+    pthread_mutex_unlock(&ps->locks[data]);
+}
+
+// libcurl does not support sharing the connection cache between
+// concurrent threads, so share_connections is only set for the multi engine
+bool probe_share_init(probe_share_t *ps, bool share_connections) {
+    ps->share = curl_share_init();
+    if (!ps->share) return false;
+    
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&ps->locks[i], NULL);
+    }
+    curl_share_setopt(ps->share, CURLSHOPT_LOCKFUNC, probe_share_lock);
+    curl_share_setopt(ps->share, CURLSHOPT_UNLOCKFUNC, probe_share_unlock);
+    curl_share_setopt(ps->share, CURLSHOPT_USERDATA, ps);
+    curl_share_setopt(ps->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(ps->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (share_connections) {
+        curl_share_setopt(ps->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    return true;
+}
+
+void probe_share_destroy(probe_share_t *ps) {
+    curl_share_cleanup(ps->share);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&ps->locks[i]);
+    }
+}
+
+// Free list of easy handles owned by one worker. Handles keep their
+// connections alive between probes instead of reconnecting for each URL.
+typedef struct {
+    CURL **handles;
+    int count;
+    int capacity;
+    CURLSH *share;
+} handle_pool_t;
+
+void handle_pool_init(handle_pool_t *hp, CURLSH *share) {
+    memset(hp, 0, sizeof(*hp));
+    hp->share = share;
+}
+
+CURL *handle_pool_get(handle_pool_t *hp) {
+    if (hp->count > 0) {
+        return hp->handles[--hp->count];
+    }
+    
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+    if (hp->share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, hp->share);
+    }
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    return curl;
+}
+
+void handle_pool_put(handle_pool_t *hp, CURL *curl) {
+    if (hp->count == hp->capacity) {
+        int capacity = hp->capacity ? hp->capacity * 2 : 16;
+        CURL **handles = realloc(hp->handles, capacity * sizeof(CURL *));
+        if (!handles) {
+            curl_easy_cleanup(curl);
+            return;
+        }
+        hp->handles = handles;
+        hp->capacity = capacity;
+    }
+    hp->handles[hp->count++] = curl;
+}
+
+void handle_pool_destroy(handle_pool_t *hp) {
+    for (int i = 0; i < hp->count; i++) {
+        curl_easy_cleanup(hp->handles[i]);
+    }
+    free(hp->handles);
+    memset(hp, 0, sizeof(*hp));
+}
+
+// On-disk verification cache: a header followed by an open-addressing
+// hash table of fixed-size records, mapped straight into memory
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t count;
+} cache_header_t;
+
+typedef struct {
+    uint64_t key;                 // FNV-1a hash of the URL, 0 marks an empty slot
+    int64_t checked_at;
+    int32_t status;
+    uint8_t is_valid;
+    uint8_t reserved[3];
+    char etag[CACHE_ETAG_LENGTH];
+    char last_modified[CACHE_DATE_LENGTH];
+    int64_t content_length;
+    int32_t duration_ms;
+    uint8_t reserved2[4];
+    char title[MEDIA_TITLE_LENGTH];
+    char artist[MEDIA_ARTIST_LENGTH];
+} cache_record_t;
+
+typedef struct {
+    char *path;
+    int fd;
+    cache_header_t *header;
+    cache_record_t *records;
+    size_t map_size;
+    int ttl;
+    pthread_mutex_t lock;
+} verify_cache_t;
+
+uint64_t hash_url(const char *url) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)url; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+size_t cache_file_size(uint32_t capacity) {
+    return sizeof(cache_header_t) + (size_t)capacity * sizeof(cache_record_t);
+}
+
+// Map path with room for capacity records, creating an empty table if needed
+bool cache_map(verify_cache_t *cache, const char *path, uint32_t capacity, bool reset) {
+    int fd = open(path, O_RDWR | O_CREAT | (reset ? O_TRUNC : 0), 0644);
+    if (fd < 0) return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    
+    bool fresh = (size_t)st.st_size < sizeof(cache_header_t);
+    if (!fresh) {
+        cache_header_t header;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, CACHE_MAGIC, 4) != 0 || header.version != CACHE_VERSION ||
+            header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+            (size_t)st.st_size != cache_file_size(header.capacity)) {
+            fprintf(stderr, "Warning: Ignoring invalid cache file '%s'.\n", path);
+            fresh = true;
+        } else {
+            capacity = header.capacity;
+        }
+    }
+    
+    size_t size = cache_file_size(capacity);
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        close(fd);
+        return false;
+    }
+    
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    
+    cache->fd = fd;
+    cache->map_size = size;
+    cache->header = (cache_header_t *)map;
+    cache->records = (cache_record_t *)((char *)map + sizeof(cache_header_t));
+    if (fresh) {
+        memcpy(cache->header->magic, CACHE_MAGIC, 4);
+        cache->header->version = CACHE_VERSION;
+        cache->header->capacity = capacity;
+        cache->header->count = 0;
+    }
+    return true;
+}
+
+void cache_unmap(verify_cache_t *cache) {
+    msync(cache->header, cache->map_size, MS_ASYNC);
+    munmap(cache->header, cache->map_size);
+    close(cache->fd);
+    cache->header = NULL;
+    cache->records = NULL;
+}
+
+bool verify_cache_open(verify_cache_t *cache, const char *path, int ttl) {
+    memset(cache, 0, sizeof(*cache));
+    cache->ttl = ttl;
+    cache->path = strdup(path);
+    if (!cache->path || !cache_map(cache, path, CACHE_INITIAL_CAPACITY, false)) {
+        free(cache->path);
+        return false;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return true;
+}
+
+void verify_cache_close(verify_cache_t *cache) {
+    cache_unmap(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+}
+
+// Find the slot for key: either its record or the empty slot to insert into
+cache_record_t *cache_slot(cache_record_t *records, uint32_t capacity, uint64_t key) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = (uint32_t)key & mask;; i = (i + 1) & mask) {
+        if (records[i].key == key || records[i].key == 0) return &records[i];
+    }
+}
+
+// Double the table into a new file and swap it in place of the old one
+bool cache_grow(verify_cache_t *cache) {
+    size_t tmp_len = strlen(cache->path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    if (!tmp_path) return false;
+    snprintf(tmp_path, tmp_len, "%s.tmp", cache->path);
+    
+    verify_cache_t grown = *cache;
+    if (!cache_map(&grown, tmp_path, cache->header->capacity * 2, true)) {
+        free(tmp_path);
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < cache->header->capacity; i++) {
+        if (cache->records[i].key == 0) continue;
+        *cache_slot(grown.records, grown.header->capacity, cache->records[i].key) = cache->records[i];
+    }
+    grown.header->count = cache->header->count;
+    
+    bool ok = rename(tmp_path, cache->path) == 0;
+    if (ok) {
+        cache_unmap(cache);
+        cache->fd = grown.fd;
+        cache->header = grown.header;
+        cache->records = grown.records;
+        cache->map_size = grown.map_size;
+    } else {
+        cache_unmap(&grown);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+bool verify_cache_lookup(verify_cache_t *cache, const char *url, cache_record_t *out) {
+    uint64_t key = hash_url(url);
+    pthread_mutex_lock(&cache->lock);
+    cache_record_t *record = cache_slot(cache->records, cache->header->capacity, key);
+    bool found = record->key == key;
+    if (found) *out = *record;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+void verify_cache_store(verify_cache_t *cache, const url_check_t *check) {
+    uint64_t key = hash_url(check->url);
+    pthread_mutex_lock(&cache->lock);
+    
+    cache_record_t *record = cache_slot(cache->records, cache->header->capacity, key);
+    if (record->key == 0) {
+        // Keep the load factor under 3/4 so probes stay short
+        if ((cache->header->count + 1) * 4 > cache->header->capacity * 3) {
+            if (!cache_grow(cache)) {
+                pthread_mutex_unlock(&cache->lock);
+                return;
+            }
+            record = cache_slot(cache->records, cache->header->capacity, key);
+        }
+        cache->header->count++;
+    }
+    
+    record->key = key;
+    record->checked_at = (int64_t)time(NULL);
+    record->status = (int32_t)check->status;
+    record->is_valid = check->is_valid;
+    memcpy(record->etag, check->etag, sizeof(record->etag));
+    memcpy(record->last_modified, check->last_modified, sizeof(record->last_modified));
+    record->content_length = check->media.content_length;
+    record->duration_ms = check->media.duration_ms;
+    memcpy(record->title, check->media.title, sizeof(record->title));
+    memcpy(record->artist, check->media.artist, sizeof(record->artist));
+    
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Restore the media details a cache record kept for its URL
+void cache_record_media(const cache_record_t *record, media_info_t *media) {
+    media->content_length = record->content_length;
+    media->duration_ms = record->duration_ms;
+    memcpy(media->title, record->title, sizeof(media->title));
+    memcpy(media->artist, record->artist, sizeof(media->artist));
+}
+
+// --index-source: the URLs a remote listing names, kept as an open-addressing
+// set of URL hashes, and the part of the URL space the listing is complete for
+typedef struct {
+    uint64_t *keys;               // hash_url() of each listed URL, 0 marks an empty slot
+    uint32_t capacity;
+    uint32_t count;
+    long entries;                 // listing entries, before adding their decoded forms
+    char *covered;                // prefix of URLs the listing is complete for, NULL if it only confirms
+    bool recursive;               // the coverage includes subdirectories of covered
+    long answered;                // probes answered without a request
+} index_listing_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} index_body_t;
+
+size_t index_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    index_body_t *body = (index_body_t *)userp;
+    size_t n = size * nmemb;
+    if (body->len + n + 1 > body->capacity) {
+        size_t capacity = body->capacity ? body->capacity : 65536;
+        while (capacity < body->len + n + 1) capacity *= 2;
+        char *data = realloc(body->data, capacity);
+        if (!data) return 0;
+        body->data = data;
+        body->capacity = capacity;
+    }
+    memcpy(body->data + body->len, contents, n);
+    body->len += n;
+    body->data[body->len] = '\0';
+    return n;
+}
+
+// GET url into body, NUL-terminated. effective_url, if given, receives the
+// URL after redirects, which relative references in the listing resolve against.
+bool index_fetch(CURL *curl, const config_t *config, const char *url, index_body_t *body, char **effective_url) {
+    body->len = 0;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, index_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)INDEX_FETCH_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)(config->connect_timeout * 1000));
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    CURLcode res = curl_easy_perform(curl);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (res != CURLE_OK || status < 200 || status >= 300) {
+        fprintf(stderr, "Error: Failed to fetch index source '%s': %s.\n", url,
+                res != CURLE_OK ? curl_easy_strerror(res) : "unexpected HTTP status");
+        return false;
+    }
+    if (!body->data) {
+        // An empty listing still comes back as a string
+        index_write_callback("", 1, 0, body);
+        if (!body->data) return false;
+    }
+    
+    if (effective_url) {
+        const char *effective = NULL;
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective);
+        *effective_url = strdup(effective ? effective : url);
+        if (!*effective_url) return false;
+    }
+    return true;
+}
+
+bool index_listing_insert(index_listing_t *ix, uint64_t key) {
+    // Same 3/4 load factor as the verification cache
+    if ((ix->count + 1) * 4 > ix->capacity * 3) {
+        uint32_t capacity = ix->capacity ? ix->capacity * 2 : INDEX_INITIAL_CAPACITY;
+        uint64_t *keys = calloc(capacity, sizeof(uint64_t));
+        if (!keys) return false;
+        for (uint32_t i = 0; i < ix->capacity; i++) {
+            if (!ix->keys[i]) continue;
+            uint32_t j = (uint32_t)ix->keys[i] & (capacity - 1);
+            while (keys[j]) j = (j + 1) & (capacity - 1);
+            keys[j] = ix->keys[i];
+        }
+        free(ix->keys);
+        ix->keys = keys;
+        ix->capacity = capacity;
+    }
+    uint32_t mask = ix->capacity - 1;
+    uint32_t i = (uint32_t)key & mask;
+    while (ix->keys[i] && ix->keys[i] != key) i = (i + 1) & mask;
+    if (!ix->keys[i]) {
+        ix->keys[i] = key;
+        ix->count++;
+    }
+    return true;
+}
+
+bool index_listing_contains(const index_listing_t *ix, const char *url) {
+    if (ix->count == 0) return false;
+    uint64_t key = hash_url(url);
+    uint32_t mask = ix->capacity - 1;
+    for (uint32_t i = (uint32_t)key & mask; ix->keys[i]; i = (i + 1) & mask) {
+        if (ix->keys[i] == key) return true;
+    }
+    return false;
+}
+
+// Whether the listing settles url: *listed tells if it exists. URLs outside
+// the covered prefix, or any URL of a listing that only confirms, are left
+// to a probe unless they are listed.
+bool index_listing_lookup(const index_listing_t *ix, const char *url, bool *listed) {
+    *listed = index_listing_contains(ix, url);
+    if (*listed || !ix->covered) return *listed;
+    size_t len = strlen(ix->covered);
+    if (strncmp(url, ix->covered, len) != 0) return false;
+    return !strpbrk(url + len, ix->recursive ? "?#" : "?#/");
+}
+
+// Decode XML/HTML character references in s[0, len) in place
+size_t index_unescape(char *s, size_t len) {
+    static const struct {
+        const char *name;
+        char c;
+    } entities[] = {{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '&') {
+            size_t left = len - i;
+            bool decoded = false;
+            for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]) && !decoded; e++) {
+                size_t n = strlen(entities[e].name);
+                if (left >= n && memcmp(s + i, entities[e].name, n) == 0) {
+                    c = entities[e].c;
+                    i += n - 1;
+                    decoded = true;
+                }
+            }
+            if (!decoded && left > 3 && s[i + 1] == '#') {
+                char *end;
+                bool hex = s[i + 2] == 'x' || s[i + 2] == 'X';
+                long cp = strtol(s + i + (hex ? 3 : 2), &end, hex ? 16 : 10);
+                if (end < s + len && *end == ';' && cp > 0 && cp < 0x80) {
+                    c = (char)cp;
+                    i = (size_t)(end - s);
+                }
+            }
+        }
+        s[out++] = c;
+    }
+    return out;
+}
+
+// Length of the scheme://host[:port] part of url
+size_t url_origin_length(const char *url) {
+    const char *host = strstr(url, "://");
+    if (!host) return 0;
+    host += 3;
+    return (size_t)(host - url) + strcspn(host, "/?#");
+}
+
+// Length of url up to and including the last '/' of its path
+size_t url_directory_length(const char *url) {
+    size_t origin = url_origin_length(url);
+    size_t path_end = origin + strcspn(url + origin, "?#");
+    size_t len = path_end;
+    while (len > origin && url[len - 1] != '/') len--;
+    return len;
+}
+
+// Whether c has to be percent-encoded to appear in a URL
+bool url_needs_escape(unsigned char c) {
+    return c <= ' ' || c >= 0x7f || strchr("\"<>\\^`{|}", c);
+}
+
+// Add the listing entry ref[0, len), resolved against base_url, as it was
+// listed and also percent-decoded or percent-encoded, since templates may
+// spell a name either way (S3 keys come raw, directory indexes encoded).
+// An S3 key is appended to base_url as it is, even when it starts with '/'.
+bool index_listing_add(index_listing_t *ix, const char *base_url, const char *ref, size_t len, bool key) {
+    while (!key && len > 0 && isspace((unsigned char)*ref)) {
+        ref++;
+        len--;
+    }
+    while (!key && len > 0 && isspace((unsigned char)ref[len - 1])) len--;
+    if (len == 0 || len >= MAX_URL_LENGTH) return true;
+    
+    char url[MAX_URL_LENGTH * 2 + 2];
+    size_t prefix_len;
+    const char *colon = memchr(ref, ':', len);
+    if (key) {
+        prefix_len = strlen(base_url);
+    } else if (colon && colon + 2 < ref + len && colon[1] == '/' && colon[2] == '/' && !memchr(ref, '/', colon - ref)) {
+        prefix_len = 0;
+    } else if (len > 1 && ref[0] == '/' && ref[1] == '/') {
+        prefix_len = strstr(base_url, "//") ? (size_t)(strstr(base_url, "//") - base_url) : 0;
+    } else if (ref[0] == '/') {
+        prefix_len = url_origin_length(base_url);
+    } else {
+        prefix_len = url_directory_length(base_url);
+        if (len > 2 && ref[0] == '.' && ref[1] == '/') {
+            ref += 2;
+            len -= 2;
+        }
+    }
+    if (prefix_len >= MAX_URL_LENGTH) return true;
+    memcpy(url, base_url, prefix_len);
+    memcpy(url + prefix_len, ref, len);
+    size_t url_len = prefix_len + index_unescape(url + prefix_len, len);
+    url[url_len] = '\0';
+    
+    ix->entries++;
+    if (!index_listing_insert(ix, hash_url(url))) return false;
+    if (memchr(url + prefix_len, '%', url_len - prefix_len)) {
+        int decoded_len = 0;
+        char *decoded = curl_easy_unescape(NULL, url, (int)url_len, &decoded_len);
+        if (!decoded) return false;
+        bool ok = index_listing_insert(ix, hash_url(decoded));
+        curl_free(decoded);
+        return ok;
+    }
+    
+    char encoded[MAX_URL_LENGTH * 6 + 2];
+    size_t encoded_len = 0;
+    bool escaped = false;
+    for (size_t i = 0; i < url_len; i++) {
+        unsigned char c = (unsigned char)url[i];
+        if (i >= prefix_len && url_needs_escape(c)) {
+            encoded_len += sprintf(encoded + encoded_len, "%%%02X", c);
+            escaped = true;
+        } else {
+            encoded[encoded_len++] = (char)c;
+        }
+    }
+    encoded[encoded_len] = '\0';
+    return !escaped || index_listing_insert(ix, hash_url(encoded));
+}
+
+// Text of the first <tag>...</tag> at or after p, or NULL
+const char *xml_element(const char *p, const char *tag, size_t *len) {
+    char open[64], close[64];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+    const char *start = strstr(p, open);
+    if (!start) return NULL;
+    start += strlen(open);
+    const char *end = strstr(start, close);
+    if (!end) return NULL;
+    *len = (size_t)(end - start);
+    return start;
+}
+
+// Value of query parameter name in url, percent-decoded, or NULL if absent
+char *url_query_param(const char *url, const char *name) {
+    const char *query = strchr(url, '?');
+    size_t name_len = strlen(name);
+    for (const char *p = query; p; p = strchr(p + 1, '&')) {
+        if (strncmp(p + 1, name, name_len) != 0 || p[1 + name_len] != '=') continue;
+        const char *value = p + 2 + name_len;
+        int len = 0;
+        return curl_easy_unescape(NULL, value, (int)strcspn(value, "&#"), &len);
+    }
+    return NULL;
+}
+
+// S3 ListObjectsV2: keys are relative to the bucket URL, the listing is
+// complete for its prefix, and truncated responses continue page by page
+bool index_load_s3(index_listing_t *ix, CURL *curl, const config_t *config, const char *url, index_body_t *body) {
+    size_t base_len = strcspn(url, "?#");
+    char *base = malloc(base_len + 2);
+    if (!base) return false;
+    memcpy(base, url, base_len);
+    if (base_len == 0 || base[base_len - 1] != '/') base[base_len++] = '/';
+    base[base_len] = '\0';
+    
+    char *prefix = url_query_param(url, "prefix");
+    char *delimiter = url_query_param(url, "delimiter");
+    ix->recursive = !delimiter || !*delimiter;
+    ix->covered = malloc(base_len + (prefix ? strlen(prefix) : 0) + 1);
+    bool ok = ix->covered != NULL;
+    if (ok) sprintf(ix->covered, "%s%s", base, prefix ? prefix : "");
+    curl_free(prefix);
+    curl_free(delimiter);
+    
+    for (int page = 1; ok; page++) {
+        for (const char *p = body->data;;) {
+            size_t len;
+            const char *key = xml_element(p, "Key", &len);
+            if (!key) break;
+            if (!index_listing_add(ix, base, key, len, true)) {
+                ok = false;
+                break;
+            }
+            p = key + len;
+        }
+        
+        size_t len;
+        const char *truncated = xml_element(body->data, "IsTruncated", &len);
+        if (!ok || !truncated || strncmp(truncated, "true", len) != 0) break;
+        const char *token = xml_element(body->data, "NextContinuationToken", &len);
+        if (!token || page == INDEX_MAX_PAGES) {
+            // The listing is incomplete, so it can only confirm the keys it has
+            fprintf(stderr, "Warning: Index source '%s' is truncated; unlisted URLs will be probed.\n", url);
+            free(ix->covered);
+            ix->covered = NULL;
+            break;
+        }
+        char *escaped = curl_easy_escape(NULL, token, (int)len);
+        size_t next_len = strlen(url) + (escaped ? strlen(escaped) : 0) + 32;
+        char *next = escaped ? malloc(next_len) : NULL;
+        if (next) {
+            snprintf(next, next_len, "%s%ccontinuation-token=%s", url, strchr(url, '?') ? '&' : '?', escaped);
+        }
+        curl_free(escaped);
+        ok = next && index_fetch(curl, config, next, body, NULL);
+        free(next);
+    }
+    free(base);
+    return ok;
+}
+
+// nginx (or Apache) autoindex: every href of the page names an entry of
+// the directory, which the page lists completely but not recursively. Any
+// other HTML page only confirms the URLs it links to.
+bool index_load_autoindex(index_listing_t *ix, const char *url, const index_body_t *body, bool complete) {
+    if (complete) {
+        ix->covered = strndup(url, url_directory_length(url));
+        if (!ix->covered) return false;
+        ix->recursive = false;
+    }
+    
+    for (const char *p = body->data; (p = strstr(p, "href=")) != NULL;) {
+        p += 5;
+        char quote = *p;
+        if (quote != '"' && quote != '\'') continue;
+        const char *ref = ++p;
+        const char *end = strchr(ref, quote);
+        if (!end) break;
+        p = end + 1;
+        size_t len = (size_t)(end - ref);
+        // Sort links, fragments and the parent directory are not entries
+        if (len == 0 || ref[0] == '?' || ref[0] == '#' || strncmp(ref, "../", 3) == 0) continue;
+        if (!index_listing_add(ix, url, ref, len, false)) return false;
+    }
+    return true;
+}
+
+// HLS playlist: its URI lines (and URI= attributes) confirm that those
+// entries exist, but say nothing about anything it leaves out
+bool index_load_hls(index_listing_t *ix, const char *url, const index_body_t *body) {
+    for (const char *line = body->data; *line;) {
+        size_t len = strcspn(line, "\r\n");
+        if (line[0] != '#') {
+            if (!index_listing_add(ix, url, line, len, false)) return false;
+        } else {
+            for (const char *p = line; p + 5 < line + len; p++) {
+                if (memcmp(p, "URI=\"", 5) != 0) continue;
+                p += 5;
+                const char *end = memchr(p, '"', (size_t)(line + len - p));
+                if (!end) break;
+                if (!index_listing_add(ix, url, p, (size_t)(end - p), false)) return false;
+                p = end;
+            }
+        }
+        line += len;
+        while (*line == '\r' || *line == '\n') line++;
+    }
+    return true;
+}
+
+bool contains_nocase(const char *s, const char *needle) {
+    size_t n = strlen(needle);
+    for (; *s; s++) {
+        if (strncasecmp(s, needle, n) == 0) return true;
+    }
+    return false;
+}
+
+// Fetch and parse the --index-source listing, telling its kind from the body
+bool index_listing_load(index_listing_t *ix, const config_t *config, const char *url) {
+    memset(ix, 0, sizeof(*ix));
+    CURL *curl = curl_easy_init();
+    if (!curl) return false;
+    
+    index_body_t body = {0};
+    char *effective = NULL;
+    bool ok = index_fetch(curl, config, url, &body, &effective);
+    if (ok) {
+        const char *text = body.data;
+        if (strncmp(text, "\xef\xbb\xbf", 3) == 0) text += 3;
+        while (isspace((unsigned char)*text)) text++;
+        if (strncmp(text, "#EXTM3U", 7) == 0) {
+            ok = index_load_hls(ix, effective, &body);
+        } else if (strstr(text, "<ListBucketResult")) {
+            ok = index_load_s3(ix, curl, config, url, &body);
+        } else if (contains_nocase(text, "<title>Index of ") || contains_nocase(text, "<title>Directory listing for ")) {
+            ok = index_load_autoindex(ix, effective, &body, true);
+        } else if (contains_nocase(text, "<a ")) {
+            // An error or landing page must not turn every unlinked URL invalid
+            fprintf(stderr, "Warning: Index source '%s' is not a directory index; URLs it does not link will be probed.\n", url);
+            ok = index_load_autoindex(ix, effective, &body, false);
+        } else {
+            fprintf(stderr, "Error: Index source '%s' is not an S3 listing, directory index or HLS playlist.\n", url);
+            ok = false;
+        }
+    }
+    free(effective);
+    free(body.data);
+    curl_easy_cleanup(curl);
+    return ok;
+}
+
+void index_listing_free(index_listing_t *ix) {
+    free(ix->keys);
+    free(ix->covered);
+}
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// AIMD concurrency limit for --adaptive. The limit starts low, doubles per
+// round trip until the first sign of congestion and then grows by one per
+// round trip while latency holds. Throttling (HTTP 429/503) and timeouts
+// halve it, and Retry-After pauses new probes altogether.
+typedef struct {
+    pthread_mutex_t lock;
+    double limit;
+    double ssthresh;              // growth turns linear above this
+    int max_limit;
+    double latency_ewma;          // seconds
+    double latency_floor;         // lowest smoothed latency seen
+    double last_decrease;
+    double pause_until;
+    long throttled;
+} rate_limiter_t;
+
+typedef enum {
+    PROBE_SIGNAL_OK,              // answered normally, whatever the status
+    PROBE_SIGNAL_THROTTLED,       // HTTP 429 or 503
+    PROBE_SIGNAL_TIMEOUT
+} probe_signal_t;
+
+void rate_limiter_init(rate_limiter_t *rl, int max_limit) {
+    memset(rl, 0, sizeof(*rl));
+    pthread_mutex_init(&rl->lock, NULL);
+    rl->max_limit = max_limit;
+    rl->limit = max_limit < ADAPTIVE_INITIAL_LIMIT ? max_limit : ADAPTIVE_INITIAL_LIMIT;
+    rl->ssthresh = max_limit;
+}
+
+void rate_limiter_destroy(rate_limiter_t *rl) {
+    pthread_mutex_destroy(&rl->lock);
+}
+
+// Number of probes allowed in flight right now
+int rate_limiter_allowed(rate_limiter_t *rl) {
+    pthread_mutex_lock(&rl->lock);
+    int allowed = (int)rl->limit;
+    pthread_mutex_unlock(&rl->lock);
+    return allowed;
+}
+
+// Seconds until new probes may start, 0 if not paused
+double rate_limiter_pause(rate_limiter_t *rl) {
+    pthread_mutex_lock(&rl->lock);
+    double remaining = rl->pause_until - monotonic_seconds();
+    pthread_mutex_unlock(&rl->lock);
+    return remaining > 0 ? remaining : 0;
+}
+
+void rate_limiter_record(rate_limiter_t *rl, probe_signal_t signal, double latency, long retry_after) {
+    pthread_mutex_lock(&rl->lock);
+    double now = monotonic_seconds();
+    
+    if (signal == PROBE_SIGNAL_OK) {
+        rl->latency_ewma = rl->latency_ewma > 0 ? 0.8 * rl->latency_ewma + 0.2 * latency : latency;
+        if (rl->latency_floor == 0 || rl->latency_ewma < rl->latency_floor) {
+            rl->latency_floor = rl->latency_ewma;
+        }
+        
+        // Hold the limit while latency is inflated by queueing at the origin
+        if (rl->latency_ewma <= rl->latency_floor * ADAPTIVE_LATENCY_TOLERANCE) {
+            rl->limit += rl->limit < rl->ssthresh ? 1.0 : 1.0 / rl->limit;
+            if (rl->limit > rl->max_limit) rl->limit = rl->max_limit;
+        }
+    } else {
+        rl->throttled++;
+        // Decrease at most once per round trip so one burst of losses counts once
+        if (now - rl->last_decrease > rl->latency_ewma) {
+            rl->ssthresh = rl->limit / 2 > 1 ? rl->limit / 2 : 1;
+            rl->limit = rl->ssthresh;
+            rl->last_decrease = now;
+        }
+        if (retry_after >= 0) {
+            double until = now + (retry_after < MAX_RETRY_AFTER ? retry_after : MAX_RETRY_AFTER);
+            if (until > rl->pause_until) rl->pause_until = until;
+        }
+    }
+    pthread_mutex_unlock(&rl->lock);
+}
+
+// Opens after --breaker consecutive probes fail to connect to the host, after
+// which remaining probes fail fast instead of waiting out their timeouts
+typedef struct {
+    pthread_mutex_t lock;
+    int threshold;
+    int consecutive_failures;
+    bool open;
+    long skipped;
+} circuit_breaker_t;
+
+void circuit_breaker_init(circuit_breaker_t *cb, int threshold) {
+    memset(cb, 0, sizeof(*cb));
+    pthread_mutex_init(&cb->lock, NULL);
+    cb->threshold = threshold;
+}
+
+void circuit_breaker_destroy(circuit_breaker_t *cb) {
+    pthread_mutex_destroy(&cb->lock);
+}
+
+// Returns true, and counts the skip, if the probe should not be sent
+bool circuit_breaker_skip(circuit_breaker_t *cb) {
+    pthread_mutex_lock(&cb->lock);
+    bool open = cb->open;
+    if (open) cb->skipped++;
+    pthread_mutex_unlock(&cb->lock);
+    return open;
+}
+
+// A probe that never reached the server counts as a connect failure
+bool is_connect_failure(CURL *curl, CURLcode res) {
+    if (res == CURLE_COULDNT_CONNECT || res == CURLE_COULDNT_RESOLVE_HOST ||
+        res == CURLE_COULDNT_RESOLVE_PROXY) {
+        return true;
+    }
+    if (res == CURLE_OPERATION_TIMEDOUT) {
+        curl_off_t connect_us = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_us);
+        return connect_us == 0;
+    }
+    return false;
+}
+
+void circuit_breaker_record(circuit_breaker_t *cb, bool connect_failed) {
+    pthread_mutex_lock(&cb->lock);
+    if (!connect_failed) {
+        cb->consecutive_failures = 0;
+    } else if (++cb->consecutive_failures >= cb->threshold && !cb->open) {
+        cb->open = true;
+        fprintf(stderr, "\nWarning: %d consecutive connection failures, failing remaining probes fast.\n",
+                cb->consecutive_failures);
+    }
+    pthread_mutex_unlock(&cb->lock);
+}
+
+// Log-linear latency histogram in microseconds: exact below 16us, then
+// LATENCY_SUB_BUCKETS buckets per power of two
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    int64_t max_us;
+} latency_histogram_t;
+
+int latency_bucket(int64_t us) {
+    if (us < LATENCY_SUB_BUCKETS) return us < 0 ? 0 : (int)us;
+    int msb = 63 - __builtin_clzll((unsigned long long)us);
+    int index = (msb - 3) * LATENCY_SUB_BUCKETS + (int)((us >> (msb - 4)) & (LATENCY_SUB_BUCKETS - 1));
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+// Largest value that falls into bucket index
+int64_t latency_bucket_upper(int index) {
+    if (index < LATENCY_SUB_BUCKETS) return index;
+    int shift = index / LATENCY_SUB_BUCKETS - 1;
+    int64_t lower = (int64_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return lower + ((int64_t)1 << shift) - 1;
+}
+
+void latency_record(latency_histogram_t *h, int64_t us) {
+    h->buckets[latency_bucket(us)]++;
+    h->count++;
+    if (us > h->max_us) h->max_us = us;
+}
+
+// Value at quantile q (0..1], reported as the upper edge of its bucket
+int64_t latency_quantile(const latency_histogram_t *h, double q) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(q * h->count + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            int64_t upper = latency_bucket_upper(i);
+            return upper < h->max_us ? upper : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+typedef enum {
+    PHASE_DNS,                    // name lookup, new connections only
+    PHASE_CONNECT,                // TCP connect after the lookup
+    PHASE_TLS,                    // TLS handshake after the connect
+    PHASE_TTFB,                   // request sent to first response byte
+    PHASE_TOTAL,
+    PHASE_COUNT
+} probe_phase_t;
+
+static const char *const phase_names[PHASE_COUNT] = {"dns", "connect", "tls", "ttfb", "total"};
+
+// --stats: per-phase latency histograms and outcome counts of every request sent
+typedef struct {
+    pthread_mutex_t lock;
+    latency_histogram_t phases[PHASE_COUNT];
+    uint64_t status_counts[MAX_STATUS_CODE];
+    uint64_t error_counts[CURL_LAST];
+    uint64_t requests;
+    uint64_t new_connections;
+    uint64_t cache_hits;
+    uint64_t skipped;
+} probe_stats_t;
+
+void probe_stats_init(probe_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_init(&stats->lock, NULL);
+}
+
+void probe_stats_destroy(probe_stats_t *stats) {
+    pthread_mutex_destroy(&stats->lock);
+}
+
+// Record the timings libcurl kept for the transfer that just finished on curl
+void probe_stats_record(probe_stats_t *stats, CURL *curl, CURLcode res, long status) {
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0, pretransfer = 0, starttransfer = 0, total = 0;
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    
+    pthread_mutex_lock(&stats->lock);
+    stats->requests++;
+    if (connects > 0) {
+        // Reused connections report zero setup times, which would only dilute these
+        stats->new_connections++;
+        latency_record(&stats->phases[PHASE_DNS], namelookup);
+        if (connect > 0) latency_record(&stats->phases[PHASE_CONNECT], connect - namelookup);
+        if (appconnect > 0) latency_record(&stats->phases[PHASE_TLS], appconnect - connect);
+    }
+    if (starttransfer > 0) latency_record(&stats->phases[PHASE_TTFB], starttransfer - pretransfer);
+    latency_record(&stats->phases[PHASE_TOTAL], total);
+    if (status > 0 && status < MAX_STATUS_CODE) stats->status_counts[status]++;
+    if (res != CURLE_OK && res < CURL_LAST) stats->error_counts[res]++;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+void probe_stats_count(probe_stats_t *stats, uint64_t *counter) {
+    pthread_mutex_lock(&stats->lock);
+    (*counter)++;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+void probe_stats_print(probe_stats_t *stats, FILE *out) {
+    fprintf(out, "\nProbe statistics: %llu requests, %llu new connections, %llu cache hits, %llu skipped\n",
+            (unsigned long long)stats->requests, (unsigned long long)stats->new_connections,
+            (unsigned long long)stats->cache_hits, (unsigned long long)stats->skipped);
+    fprintf(out, "  %-8s %8s %10s %10s %10s %10s\n", "phase", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const latency_histogram_t *h = &stats->phases[p];
+        if (h->count == 0) continue;
+        fprintf(out, "  %-8s %8llu %10.2f %10.2f %10.2f %10.2f\n", phase_names[p],
+                (unsigned long long)h->count, latency_quantile(h, 0.50) / 1e3,
+                latency_quantile(h, 0.90) / 1e3, latency_quantile(h, 0.99) / 1e3, h->max_us / 1e3);
+    }
+    
+    bool any_status = false;
+    for (int code = 0; code < MAX_STATUS_CODE; code++) {
+        if (!stats->status_counts[code]) continue;
+        fprintf(out, "%s %d=%llu", any_status ? "" : "  Status codes:", code,
+                (unsigned long long)stats->status_counts[code]);
+        any_status = true;
+    }
+    if (any_status) fprintf(out, "\n");
+    for (int code = 0; code < CURL_LAST; code++) {
+        if (stats->error_counts[code]) {
+            fprintf(out, "  Transport errors: %llu x %s\n", (unsigned long long)stats->error_counts[code],
+                    curl_easy_strerror((CURLcode)code));
+        }
+    }
+}
+
+bool probe_stats_write_json(probe_stats_t *stats, const char *path) {
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out) return false;
+    
+    fprintf(out, "{\"requests\":%llu,\"new_connections\":%llu,\"cache_hits\":%llu,\"skipped\":%llu,\"phases\":{",
+            (unsigned long long)stats->requests, (unsigned long long)stats->new_connections,
+            (unsigned long long)stats->cache_hits, (unsigned long long)stats->skipped);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const latency_histogram_t *h = &stats->phases[p];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+                p ? "," : "", phase_names[p], (unsigned long long)h->count,
+                latency_quantile(h, 0.50) / 1e3, latency_quantile(h, 0.90) / 1e3,
+                latency_quantile(h, 0.99) / 1e3, h->max_us / 1e3);
+    }
+    fprintf(out, "},\"status\":{");
+    bool first = true;
+    for (int code = 0; code < MAX_STATUS_CODE; code++) {
+        if (!stats->status_counts[code]) continue;
+        fprintf(out, "%s\"%d\":%llu", first ? "" : ",", code, (unsigned long long)stats->status_counts[code]);
+        first = false;
+    }
+    fprintf(out, "},\"errors\":[");
+    first = true;
+    for (int code = 0; code < CURL_LAST; code++) {
+        if (!stats->error_counts[code]) continue;
+        fprintf(out, "%s{\"code\":%d,\"message\":\"%s\",\"count\":%llu}", first ? "" : ",", code,
+                curl_easy_strerror((CURLcode)code), (unsigned long long)stats->error_counts[code]);
+        first = false;
+    }
+    fprintf(out, "]}\n");
+    
+    if (out == stdout) return fflush(out) == 0;
+    return fclose(out) == 0;
+}
+
+// What --probe auto has learned about the origin's HEAD handling
+typedef struct {
+    pthread_mutex_t lock;
+    bool head_rejected;           // HEAD is refused or wrong; send range GETs only
+    int head_confirmed;           // HEAD failures that a range GET agreed with
+} head_fallback_t;
+
+void head_fallback_init(head_fallback_t *hf) {
+    memset(hf, 0, sizeof(*hf));
+    pthread_mutex_init(&hf->lock, NULL);
+}
+
+void head_fallback_destroy(head_fallback_t *hf) {
+    pthread_mutex_destroy(&hf->lock);
+}
+
+// State shared by every probe, whichever backend runs it
+typedef struct {
+    const config_t *config;
+    verify_cache_t *cache;
+    index_listing_t *index;       // NULL unless --index-source
+    rate_limiter_t *limiter;      // NULL unless --adaptive
+    circuit_breaker_t *breaker;   // NULL unless --breaker
+    head_fallback_t *fallback;    // NULL unless --probe auto
+    probe_stats_t *stats;         // NULL unless --stats or --stats-json
+} probe_ctx_t;
+
+// Whether a fresh check starts with a range GET rather than HEAD
+bool probe_starts_with_range(probe_ctx_t *ctx) {
+    if (ctx->config->probe_strategy == PROBE_RANGE || ctx->config->sniff_bytes > 0) return true;
+    if (!ctx->fallback) return false;
+    pthread_mutex_lock(&ctx->fallback->lock);
+    bool rejected = ctx->fallback->head_rejected;
+    pthread_mutex_unlock(&ctx->fallback->lock);
+    return rejected;
+}
+
+// --probe auto: decide whether a failed HEAD is worth a range GET, and
+// learn from range GETs that followed one
+bool head_fallback_wanted(head_fallback_t *hf, long status) {
+    pthread_mutex_lock(&hf->lock);
+    bool wanted = status == 405 || status == 501 ||
+                  (status >= 400 && hf->head_confirmed < AUTO_TRUST_HEAD_AFTER);
+    pthread_mutex_unlock(&hf->lock);
+    return wanted;
+}
+
+void head_fallback_record(head_fallback_t *hf, long head_status, bool range_valid) {
+    pthread_mutex_lock(&hf->lock);
+    if (range_valid || head_status == 405 || head_status == 501) {
+        hf->head_rejected = true;
+    } else {
+        hf->head_confirmed++;
+    }
+    pthread_mutex_unlock(&hf->lock);
+}
+
+// Prepare curl to probe check->url. Returns false when a fresh cache
+// entry already answered the check and no request needs to be sent.
+bool probe_begin(probe_ctx_t *ctx, CURL *curl, url_check_t *check) {
+    check->status = 0;
+    check->etag[0] = '\0';
+    check->last_modified[0] = '\0';
+    check->from_cache = false;
+    check->revalidating = false;
+    check->headers = NULL;
+    check->retry_after = -1;
+    check->body_aborted = false;
+    media_info_reset(&check->media);
+    if (!check->retry) {
+        check->range_probe = probe_starts_with_range(ctx);
+        check->head_status = 0;
+    }
+    check->retry = false;
+    check->fallback = false;
+    
+    if (__atomic_load_n(&check->cancelled, __ATOMIC_RELAXED)) {
+        check->is_valid = false;
+        return false;
+    }
+    
+    // The --index-source listing settles covered URLs without a request;
+    // with --sniff, listed ones are still fetched for their media details
+    bool listed;
+    if (ctx->index && index_listing_lookup(ctx->index, check->url, &listed) &&
+        !(listed && ctx->config->sniff_bytes > 0)) {
+        check->is_valid = listed;
+        __atomic_fetch_add(&ctx->index->answered, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    
+    cache_record_t cached;
+    bool have_cached = ctx->cache && verify_cache_lookup(ctx->cache, check->url, &cached);
+    if (have_cached && time(NULL) - cached.checked_at < ctx->cache->ttl) {
+        check->is_valid = cached.is_valid;
+        check->status = cached.status;
+        check->from_cache = true;
+        cache_record_media(&cached, &check->media);
+        if (ctx->stats) probe_stats_count(ctx->stats, &ctx->stats->cache_hits);
+        return false;
+    }
+    
+    check->skipped = false;
+    if (ctx->breaker && circuit_breaker_skip(ctx->breaker)) {
+        check->is_valid = false;
+        check->skipped = true;
+        if (ctx->stats) probe_stats_count(ctx->stats, &ctx->stats->skipped);
+        return false;
+    }
+    
+    setup_probe(curl, ctx->config, check->url);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, check);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, check);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, check);
+    if (ctx->config->stop_after_misses > 0) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, check);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    }
+    if (check->range_probe) {
+        char range[32] = "0-0";
+        int sniff_bytes = ctx->config->sniff_bytes;
+        if (sniff_bytes > 0) {
+            check->sniff = malloc(sniff_bytes);
+            check->sniff_capacity = check->sniff ? sniff_bytes : 0;
+            check->sniff_len = 0;
+            snprintf(range, sizeof(range), "0-%d", sniff_bytes - 1);
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    }
+    
+    // Revalidate stale entries with a conditional request
+    if (have_cached && (cached.etag[0] || cached.last_modified[0])) {
+        char header[CACHE_ETAG_LENGTH + CACHE_DATE_LENGTH + 32];
+        if (cached.etag[0]) {
+            snprintf(header, sizeof(header), "If-None-Match: %s", cached.etag);
+        } else {
+            snprintf(header, sizeof(header), "If-Modified-Since: %s", cached.last_modified);
+        }
+        check->headers = curl_slist_append(NULL, header);
+        check->revalidating = check->headers != NULL;
+        check->cached_valid = cached.is_valid;
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, check->headers);
+    return true;
+}
+
+// Drop the per-request state of a finished probe
+void probe_release(CURL *curl, url_check_t *check) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(check->headers);
+    check->headers = NULL;
+    free(check->sniff);
+    check->sniff = NULL;
+    check->sniff_len = 0;
+    check->sniff_capacity = 0;
+}
+
+// Record the outcome of a finished probe. Sets check->retry when the
+// origin throttled the probe and it should be sent again after a pause.
+void probe_finish(probe_ctx_t *ctx, CURL *curl, url_check_t *check, CURLcode res) {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &check->status);
+    if (res == CURLE_WRITE_ERROR && check->body_aborted) res = CURLE_OK;
+    if (res == CURLE_ABORTED_BY_CALLBACK) {
+        // Cancelled by the consumer; says nothing about the origin
+        check->is_valid = false;
+        probe_release(curl, check);
+        return;
+    }
+    if (ctx->stats) probe_stats_record(ctx->stats, curl, res, check->status);
+    curl_off_t total_us = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_us);
+    check->latency_us += total_us;
+    
+    bool throttled = res == CURLE_OK && (check->status == 429 || check->status == 503);
+    if (ctx->breaker) {
+        circuit_breaker_record(ctx->breaker, is_connect_failure(curl, res));
+    }
+    if (ctx->limiter) {
+        probe_signal_t signal = throttled ? PROBE_SIGNAL_THROTTLED :
+                                res == CURLE_OPERATION_TIMEDOUT ? PROBE_SIGNAL_TIMEOUT :
+                                PROBE_SIGNAL_OK;
+        rate_limiter_record(ctx->limiter, signal, total_us / 1e6, check->retry_after);
+        
+        if (throttled && check->attempts < ctx->config->max_retries) {
+            check->attempts++;
+            check->retry = true;
+            probe_release(curl, check);
+            return;
+        }
+    }
+    
+    // --probe auto: try a failed HEAD again as a range GET
+    if (ctx->fallback && res == CURLE_OK && !throttled) {
+        if (!check->range_probe && !probe_succeeded(curl, res) &&
+            check->status != 304 && head_fallback_wanted(ctx->fallback, check->status)) {
+            check->head_status = check->status;
+            check->range_probe = true;
+            check->retry = true;
+            check->fallback = true;
+            probe_release(curl, check);
+            return;
+        }
+        if (check->head_status) {
+            head_fallback_record(ctx->fallback, check->head_status, probe_succeeded(curl, res));
+        }
+    }
+    
+    if (check->revalidating && res == CURLE_OK && check->status == 304) {
+        // Unchanged since the cached check; keep its validators unless the 304 sent new ones
+        check->is_valid = check->cached_valid;
+        cache_record_t cached;
+        if (verify_cache_lookup(ctx->cache, check->url, &cached)) {
+            if (!check->etag[0] && !check->last_modified[0]) {
+                memcpy(check->etag, cached.etag, sizeof(check->etag));
+                memcpy(check->last_modified, cached.last_modified, sizeof(check->last_modified));
+            }
+            cache_record_media(&cached, &check->media);
+        }
+    } else {
+        check->is_valid = probe_succeeded(curl, res);
+        if (check->is_valid) {
+            const char *type = NULL;
+            curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &type);
+            if (type) copy_header_value(check->media.content_type, sizeof(check->media.content_type),
+                                        type, strlen(type));
+            if (check->sniff_len > 0) media_sniff(&check->media, check->sniff, check->sniff_len);
+        }
+    }
+    
+    probe_release(curl, check);
+    
+    // Only definitive HTTP answers are cached, not transport errors or throttling
+    if (ctx->cache && res == CURLE_OK && !throttled) {
+        verify_cache_store(ctx->cache, check);
+    }
+}
+
+// Seconds to wait before sending a pending retry: none for a fallback,
+// otherwise any Retry-After pause and at least a second per throttled attempt
+double probe_retry_delay(probe_ctx_t *ctx, const url_check_t *check) {
+    if (check->fallback) return 0;
+    double pause = ctx->limiter ? rate_limiter_pause(ctx->limiter) : 0;
+    if (pause < check->attempts) pause = check->attempts;
+    return pause;
+}
+
+// Probe check->url on an existing easy handle
+void check_url(probe_ctx_t *ctx, CURL *curl, url_check_t *check) {
+    do {
+        if (check->retry) {
+            double pause = probe_retry_delay(ctx, check);
+            struct timespec ts = {(time_t)pause, (long)((pause - (time_t)pause) * 1e9)};
+            if (pause > 0) nanosleep(&ts, NULL);
+        }
+        if (!probe_begin(ctx, curl, check)) return;
+        CURLcode res = curl_easy_perform(curl);
+        probe_finish(ctx, curl, check, res);
+    } while (check->retry);
+}
+
+// Callbacks driving a streaming verification run. Entry seq (0-based) is
+// generated into a window slot, probed, and handed to consume strictly in
+// seq order, so no more than the window's size of entries exist at once.
+typedef struct {
+    void (*generate)(void *user, long long seq, url_check_t *check);
+    void (*consume)(void *user, long long seq, url_check_t *check);
+    void (*idle)(void *user);     // about to block waiting for results, may be NULL
+    void *user;
+    long long (*count)(void *user);  // run length rechecked after consuming; it may shrink, but
+                                     // not below the entries generated. NULL keeps the initial count
+} verify_stream_t;
+
+// Reorder window: a ring of slots between generate and consume
+typedef struct {
+    url_check_t *slots;
+    int size;
+    long long count;              // entries in the whole run
+    long long generated;
+    long long claimed;            // handed to a probe
+    long long consumed;
+} reorder_window_t;
+
+// Fixed set of worker threads that probe entries of the current window
+typedef struct {
+    pthread_t *workers;
+    int num_workers;
+    probe_ctx_t *ctx;
+    CURLSH *share;
+    reorder_window_t *window;     // run in progress, NULL when idle
+    int active;                   // probes currently running
+    bool shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+} verify_pool_t;
+
+void *verify_pool_worker(void *arg) {
+    verify_pool_t *pool = (verify_pool_t *)arg;
+    handle_pool_t handles;
+    handle_pool_init(&handles, pool->share);
+    
+    rate_limiter_t *limiter = pool->ctx->limiter;
+    
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        if (pool->shutdown) break;
+        
+        bool has_work = pool->window && pool->window->claimed < pool->window->generated;
+        if (has_work && limiter) {
+            double pause = rate_limiter_pause(limiter);
+            if (pause > 0) {
+                // Retry-After: sleep until the pause ends or the pool shuts down
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_sec += (time_t)pause + 1;
+                pthread_cond_timedwait(&pool->work_ready, &pool->lock, &until);
+                continue;
+            }
+            has_work = pool->active < rate_limiter_allowed(limiter);
+        }
+        if (!has_work) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+            continue;
+        }
+        
+        reorder_window_t *window = pool->window;
+        url_check_t *check = &window->slots[window->claimed++ % window->size];
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+        
+        CURL *curl = handle_pool_get(&handles);
+        if (curl) {
+            check_url(pool->ctx, curl, check);
+            handle_pool_put(&handles, curl);
+        } else {
+            check->is_valid = false;
+        }
+        
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        check->done = true;
+        pthread_cond_signal(&pool->work_done);
+        // The limit may have grown; let idle workers recheck it
+        if (limiter) pthread_cond_broadcast(&pool->work_ready);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    handle_pool_destroy(&handles);
+    return NULL;
+}
+
+bool verify_pool_init(verify_pool_t *pool, probe_ctx_t *ctx, CURLSH *share) {
+    int num_workers = ctx->config->threads;
+    memset(pool, 0, sizeof(*pool));
+    pool->ctx = ctx;
+    pool->share = share;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    
+    pool->workers = calloc(num_workers, sizeof(pthread_t));
+    if (!pool->workers) return false;
+    
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&pool->workers[i], NULL, verify_pool_worker, pool) != 0) {
+            break;
+        }
+        pool->num_workers++;
+    }
+    return pool->num_workers > 0;
+}
+
+// Run a stream on the worker threads; the calling thread generates and consumes
+void verify_pool_stream(verify_pool_t *pool, reorder_window_t *window, const verify_stream_t *ops) {
+    pthread_mutex_lock(&pool->lock);
+    pool->window = window;
+    
+    while (window->consumed < window->count) {
+        bool added = false;
+        while (window->generated < window->count &&
+               window->generated - window->consumed < window->size) {
+            long long seq = window->generated;
+            url_check_t *check = &window->slots[seq % window->size];
+            pthread_mutex_unlock(&pool->lock);
+            ops->generate(ops->user, seq, check);
+            check->done = false;
+            check->latency_us = 0;
+            check->attempts = 0;
+            check->retry = false;
+            check->fallback = false;
+            check->cancelled = false;
+            pthread_mutex_lock(&pool->lock);
+            window->generated++;
+            added = true;
+        }
+        if (added) pthread_cond_broadcast(&pool->work_ready);
+        
+        url_check_t *head = &window->slots[window->consumed % window->size];
+        if (!head->done && ops->idle) {
+            pthread_mutex_unlock(&pool->lock);
+            ops->idle(ops->user);
+            pthread_mutex_lock(&pool->lock);
+        }
+        while (!head->done) {
+            pthread_cond_wait(&pool->work_done, &pool->lock);
+        }
+        
+        while (window->consumed < window->generated &&
+               window->slots[window->consumed % window->size].done) {
+            long long seq = window->consumed;
+            pthread_mutex_unlock(&pool->lock);
+            ops->consume(ops->user, seq, &window->slots[seq % window->size]);
+            pthread_mutex_lock(&pool->lock);
+            window->consumed++;
+        }
+        if (ops->count) window->count = ops->count(ops->user);
+    }
+    
+    pool->window = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void verify_pool_destroy(verify_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+}
+
+// Set up the multi handle, multiplexing HTTP/2 streams over a capped
+// number of connections per host when --http2 is given
+CURLM *verify_multi_init(const config_t *config) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) return NULL;
+    
+    if (config->http2) {
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)config->max_host_connections);
+        curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)config->max_inflight);
+    } else if (config->max_host_connections > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)config->max_host_connections);
+    }
+    return multi;
+}
+
+// Run a stream on a single curl_multi event loop, keeping at most
+// config->max_inflight probes running at once; false if it could not start
+bool verify_multi_stream(CURLM *multi, handle_pool_t *handles, probe_ctx_t *ctx,
+                         reorder_window_t *window, const verify_stream_t *ops) {
+    int max_inflight = ctx->config->max_inflight;
+    int inflight = 0;
+    int running = 0;
+    
+    // Throttled or fallback probes waiting to be sent again; each window slot is queued at most once
+    url_check_t **retries = calloc(window->size, sizeof(url_check_t *));
+    if (!retries) return false;
+    int num_retries = 0;
+    
+    while (window->consumed < window->count) {
+        while (window->generated < window->count &&
+               window->generated - window->consumed < window->size) {
+            long long seq = window->generated++;
+            url_check_t *check = &window->slots[seq % window->size];
+            ops->generate(ops->user, seq, check);
+            check->done = false;
+            check->latency_us = 0;
+            check->attempts = 0;
+            check->retry = false;
+            check->fallback = false;
+            check->cancelled = false;
+        }
+        
+        int limit = max_inflight;
+        double pause = 0;
+        if (ctx->limiter) {
+            int allowed = rate_limiter_allowed(ctx->limiter);
+            if (allowed < limit) limit = allowed;
+            pause = rate_limiter_pause(ctx->limiter);
+        }
+        
+        // Retries go first once their backoff has passed, as in check_url
+        double now = monotonic_seconds();
+        while (pause == 0 && inflight < limit) {
+            url_check_t *check = NULL;
+            for (int r = 0; r < num_retries && !check; r++) {
+                if (retries[r]->retry_at <= now) {
+                    check = retries[r];
+                    retries[r] = retries[--num_retries];
+                }
+            }
+            if (!check && window->claimed < window->generated) {
+                check = &window->slots[window->claimed++ % window->size];
+            }
+            if (!check) break;
+            CURL *curl = handle_pool_get(handles);
+            if (!curl) {
+                check->is_valid = false;
+                check->done = true;
+                continue;
+            }
+            if (!probe_begin(ctx, curl, check)) {
+                handle_pool_put(handles, curl);
+                check->done = true;
+                continue;
+            }
+            curl_multi_add_handle(multi, curl);
+            inflight++;
+        }
+        
+        if (inflight > 0) {
+            curl_multi_perform(multi, &running);
+            
+            CURLMsg *msg;
+            int msgs_left;
+            while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                
+                CURL *curl = msg->easy_handle;
+                CURLcode res = msg->data.result;
+                url_check_t *check = NULL;
+                curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&check);
+                curl_multi_remove_handle(multi, curl);
+                probe_finish(ctx, curl, check, res);
+                handle_pool_put(handles, curl);
+                inflight--;
+                if (check->retry) {
+                    check->retry_at = monotonic_seconds() + probe_retry_delay(ctx, check);
+                    retries[num_retries++] = check;
+                } else {
+                    check->done = true;
+                }
+            }
+        }
+        
+        bool drained = false;
+        while (window->consumed < window->generated &&
+               window->slots[window->consumed % window->size].done) {
+            long long seq = window->consumed++;
+            ops->consume(ops->user, seq, &window->slots[seq % window->size]);
+            drained = true;
+        }
+        if (ops->count) window->count = ops->count(ops->user);
+        
+        // Wait for transfers, a retry's backoff or a Retry-After pause; with
+        // nothing in flight the poll is only a timed sleep
+        bool waiting = num_retries > 0 || (pause > 0 && window->claimed < window->generated);
+        if (!drained && (inflight > 0 || waiting)) {
+            if (ops->idle) ops->idle(ops->user);
+            double wait = 1.0;
+            if (pause > 0 && pause < wait) wait = pause;
+            now = monotonic_seconds();
+            for (int r = 0; r < num_retries; r++) {
+                if (retries[r]->retry_at - now < wait) wait = retries[r]->retry_at - now;
+            }
+            curl_multi_poll(multi, NULL, 0, wait > 0 ? (int)(wait * 1000) + 1 : 1, NULL);
+        }
+    }
+    free(retries);
+    return true;
+}
+
+// Verification backend chosen at startup: the multi event loop when
+// --max-inflight is set, the worker thread pool otherwise
+typedef struct {
+    const config_t *config;
+    bool use_multi;
+    probe_ctx_t ctx;
+    verify_cache_t cache;
+    index_listing_t index;
+    rate_limiter_t limiter;
+    circuit_breaker_t breaker;
+    head_fallback_t fallback;
+    probe_stats_t stats;
+    probe_share_t share;
+    verify_pool_t pool;
+    handle_pool_t handles;
+    CURLM *multi;
+} verify_engine_t;
+
+void verify_engine_destroy(verify_engine_t *engine) {
+    if (engine->use_multi) {
+        handle_pool_destroy(&engine->handles);
+        curl_multi_cleanup(engine->multi);
+    } else {
+        verify_pool_destroy(&engine->pool);
+    }
+    probe_share_destroy(&engine->share);
+    if (engine->ctx.cache) verify_cache_close(&engine->cache);
+    if (engine->ctx.limiter) rate_limiter_destroy(&engine->limiter);
+    if (engine->ctx.breaker) circuit_breaker_destroy(&engine->breaker);
+    if (engine->ctx.fallback) head_fallback_destroy(&engine->fallback);
+    if (engine->ctx.stats) probe_stats_destroy(&engine->stats);
+    if (engine->ctx.index) index_listing_free(&engine->index);
+}
+
+bool verify_engine_init(verify_engine_t *engine, const config_t *config) {
+    memset(engine, 0, sizeof(*engine));
+    engine->config = config;
+    engine->use_multi = config->max_inflight > 0;
+    engine->ctx.config = config;
+    
+    if (config->cache_file) {
+        if (!verify_cache_open(&engine->cache, config->cache_file, config->cache_ttl)) {
+            fprintf(stderr, "Error: Failed to open cache file '%s'.\n", config->cache_file);
+            return false;
+        }
+        engine->ctx.cache = &engine->cache;
+    }
+    
+    if (config->breaker_threshold > 0) {
+        circuit_breaker_init(&engine->breaker, config->breaker_threshold);
+        engine->ctx.breaker = &engine->breaker;
+    }
+    
+    if (config->probe_strategy == PROBE_AUTO) {
+        head_fallback_init(&engine->fallback);
+        engine->ctx.fallback = &engine->fallback;
+    }
+    
+    if (config->stats || config->stats_json) {
+        probe_stats_init(&engine->stats);
+        engine->ctx.stats = &engine->stats;
+    }
+    
+    if (config->adaptive) {
+        rate_limiter_init(&engine->limiter, engine->use_multi ? config->max_inflight : config->threads);
+        engine->ctx.limiter = &engine->limiter;
+    }
+    
+    if (!probe_share_init(&engine->share, engine->use_multi)) {
+        fprintf(stderr, "Error: Failed to initialize CURL share handle.\n");
+        if (engine->ctx.cache) verify_cache_close(&engine->cache);
+        return false;
+    }
+    
+    if (engine->use_multi) {
+        engine->multi = verify_multi_init(config);
+        if (!engine->multi) {
+            fprintf(stderr, "Error: Failed to initialize CURL multi handle.\n");
+            probe_share_destroy(&engine->share);
+            if (engine->ctx.cache) verify_cache_close(&engine->cache);
+            return false;
+        }
+        handle_pool_init(&engine->handles, engine->share.share);
+    } else if (!verify_pool_init(&engine->pool, &engine->ctx, engine->share.share)) {
+        fprintf(stderr, "Error: Failed to start verification threads.\n");
+        probe_share_destroy(&engine->share);
+        if (engine->ctx.cache) verify_cache_close(&engine->cache);
+        return false;
+    }
+    
+    // One listing request up front replaces the probes of every URL it covers
+    if (config->index_source) {
+        engine->ctx.index = &engine->index;
+        if (!index_listing_load(&engine->index, config, config->index_source)) {
+            verify_engine_destroy(engine);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Number of probes the engine runs at once
+int verify_engine_concurrency(const verify_engine_t *engine) {
+    return engine->use_multi ? engine->config->max_inflight : engine->pool.num_workers;
+}
+
+// Stream count entries through the engine with a reorder window of window_size
+bool verify_engine_stream(verify_engine_t *engine, long long count, int window_size,
+                          const verify_stream_t *ops) {
+    reorder_window_t window = {0};
+    window.size = window_size;
+    window.count = count;
+    window.slots = calloc(window_size, sizeof(url_check_t));
+    if (!window.slots) return false;
+    
+    bool ok = true;
+    if (engine->use_multi) {
+        ok = verify_multi_stream(engine->multi, &engine->handles, &engine->ctx, &window, ops);
+    } else {
+        verify_pool_stream(&engine->pool, &window, ops);
+    }
+    free(window.slots);
+    return ok;
+}
+
+void batch_generate(void *user, long long seq, url_check_t *check) {
+    *check = ((url_check_t *)user)[seq];
+}
+
+void batch_consume(void *user, long long seq, url_check_t *check) {
+    ((url_check_t *)user)[seq] = *check;
+}
+
+// Verify every entry of checks[], returning once all results are in
+void verify_engine_run(verify_engine_t *engine, url_check_t *checks, int count) {
+    verify_stream_t ops = {batch_generate, batch_consume, NULL, checks, NULL};
+    if (count > 0 && !verify_engine_stream(engine, count, count, &ops)) {
+        for (int i = 0; i < count; i++) {
+            checks[i].is_valid = false;
+        }
+    }
+}
+
+void print_usage(const char *prog_name) {
+    fprintf(stderr, "Enhanced Playlist Generator v2.0\n");
+    fprintf(stderr, "Usage: %s [OPTIONS]\n\n", prog_name);
+    fprintf(stderr, "Required options:\n");
+    fprintf(stderr, "  -l <template>    URL template with wildcard (*) or ranges like {1..8:02}\n");
+    fprintf(stderr, "  -s <start>       Starting number\n");
+    fprintf(stderr, "  -e <end>         Ending number\n");
+    fprintf(stderr, "  -p <file>        Output playlist file (- for stdout)\n\n");
+    fprintf(stderr, "Optional options:\n");
+    fprintf(stderr, "  -f <format>      Playlist format: plain|m3u|m3u8|pls|xspf (default: plain)\n");
+    fprintf(stderr, "  -z <padding>     Zero-pad numbers (e.g., -z 3 for 001, 002, ...)\n");
+    fprintf(stderr, "  -v               Verify URLs (check if accessible)\n");
+    fprintf(stderr, "  -V               Verbose output\n");
+    fprintf(stderr, "  -t <threads>     Number of threads for URL verification (default: 4)\n");
+    fprintf(stderr, "  --max-inflight <n>  Verify on one event loop with up to n concurrent probes\n");
+    fprintf(stderr, "  --http2          Multiplex probes as HTTP/2 streams (implies --max-inflight %d)\n", DEFAULT_HTTP2_INFLIGHT);
+    fprintf(stderr, "  --http2-cleartext  Like --http2, and upgrade http:// URLs to HTTP/2 (h2c) as well\n");
+    fprintf(stderr, "  --max-host-connections <n>  Cap connections per host (default with --http2: %d)\n", DEFAULT_HTTP2_HOST_CONNECTIONS);
+    fprintf(stderr, "  --discover       Find the last existing index before generating (-e becomes an upper bound)\n");
+    fprintf(stderr, "  --discover-gap <k>  Tolerate up to k consecutive missing entries during discovery\n");
+    fprintf(stderr, "  --cache <file>   Keep verification results in file across runs\n");
+    fprintf(stderr, "  --cache-ttl <s>  Seconds a cached result is trusted without revalidation (default: %d)\n", DEFAULT_CACHE_TTL);
+    fprintf(stderr, "  --index-source <url>  Answer probes from one listing: an S3 ListObjectsV2 URL,\n");
+    fprintf(stderr, "                   a directory index or an HLS playlist; unlisted URLs outside it are probed\n");
+    fprintf(stderr, "  --incremental    Append only entries past the last index already in the playlist\n");
+    fprintf(stderr, "  --gen-threads <n>  Render unverified playlists on n threads (default: 1)\n");
+    fprintf(stderr, "  --adaptive       Adapt concurrency to the origin (-t or --max-inflight is the ceiling)\n");
+    fprintf(stderr, "  --max-retries <n>  Retries for throttled (429/503) probes with --adaptive (default: %d)\n", DEFAULT_MAX_RETRIES);
+    fprintf(stderr, "  --timeout <s>    Total time allowed per probe (default: %d, 0 for none)\n", DEFAULT_TIMEOUT);
+    fprintf(stderr, "  --connect-timeout <s>  Time allowed to connect (default: bounded by --timeout)\n");
+    fprintf(stderr, "  --low-speed-time <s>  Abort probes that stall for s seconds\n");
+    fprintf(stderr, "  --breaker <n>    Fail remaining probes fast after n consecutive connect failures\n");
+    fprintf(stderr, "  --probe <mode>   Probe with head|range|auto (auto retries failed HEADs as 1-byte GETs)\n");
+    fprintf(stderr, "  --sniff <bytes>  Fetch the first bytes of each URL for ID3/MP4 durations and titles\n");
+    fprintf(stderr, "  --stop-after-misses <n>  With -v, end the series after n consecutive invalid entries\n");
+    fprintf(stderr, "  --stats          Print per-phase probe latency percentiles and status counts\n");
+    fprintf(stderr, "  --stats-json <file>  Write the probe statistics as JSON (- for stdout)\n");
+    fprintf(stderr, "  --journal        With -v, checkpoint results to <output>.journal as they are written\n");
+    fprintf(stderr, "  --resume         Continue an interrupted --journal run where it stopped\n");
+    fprintf(stderr, "  --shard <K/N>    With -v and a single *, verify block K of N of the range into a shard file for merge\n");
+    fprintf(stderr, "  --serve <socket>  Answer playlist requests on a UNIX socket with warm connections:\n");
+    fprintf(stderr, "                   template[, start, end, format, padding] per connection\n");
+    fprintf(stderr, "  --jobs <file>    Run every job of a tab-separated manifest on one shared engine:\n");
+    fprintf(stderr, "                   template, output[, start, end, format, padding] per line\n");
+    fprintf(stderr, "  --compress <method>  Compress the output with gzip|zstd on a separate thread\n");
+    fprintf(stderr, "  --events ndjson  Write per-URL results and progress as JSON lines to --events-fd\n");
+    fprintf(stderr, "  --events-fd <fd>  Descriptor for --events (default: %d, e.g. %d>events.ndjson)\n",
+            DEFAULT_EVENTS_FD, DEFAULT_EVENTS_FD);
+    fprintf(stderr, "  -P <prefix>      Add prefix text to each entry\n");
+    fprintf(stderr, "  -S <suffix>      Add suffix text to each entry\n\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "  %s -l \"http://example.com/episode_*.mp3\" -s 1 -e 10 -p playlist.m3u -f m3u\n", prog_name);
+    fprintf(stderr, "  %s -l \"http://cdn.example.com/video_*.mp4\" -s 1 -e 100 -p videos.m3u8 -f m3u8 -z 3 -v\n", prog_name);
+    fprintf(stderr, "  %s -l \"http://cdn.example.com/season_{1..8:02}/ep_{1..30:02}.mp4\" -p series.m3u -f m3u --discover\n", prog_name);
+    fprintf(stderr, "  %s --jobs nightly.tsv -f m3u -v --discover --cache probes.cache\n", prog_name);
+    fprintf(stderr, "  %s -l \"http://cdn.example.com/chunk_*.ts\" -s 1 -e 10000000 -p - --compress gzip > chunks.txt.gz\n", prog_name);
+    fprintf(stderr, "  %s -l \"http://cdn.example.com/video_*.mp4\" -s 1 -e 200000 -v --shard 2/4 -p part2.lks\n", prog_name);
+    fprintf(stderr, "  %s merge -p videos.m3u -f m3u part1.lks part2.lks part3.lks part4.lks\n", prog_name);
+}
+
+playlist_format_t parse_format(const char *format_str) {
+    if (!format_str) return FORMAT_PLAIN;
+    
+    if (strcasecmp(format_str, "m3u") == 0) return FORMAT_M3U;
+    if (strcasecmp(format_str, "m3u8") == 0) return FORMAT_M3U8;
+    if (strcasecmp(format_str, "pls") == 0) return FORMAT_PLS;
+    if (strcasecmp(format_str, "xspf") == 0) return FORMAT_XSPF;
+    
+    return FORMAT_PLAIN;
+}
+
+// Write number in decimal, zero-padded to at least padding digits like %0*d.
+// dst needs room for max(padding, 11) bytes; no terminator is written.
+size_t format_index(char *dst, int number, int padding) {
+    char digits[16];
+    size_t n = 0;
+    unsigned int value = number < 0 ? 0u - (unsigned int)number : (unsigned int)number;
+    
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    size_t len = 0;
+    if (number < 0) {
+        dst[len++] = '-';
+        padding--;
+    }
+    for (int pad = padding - (int)n; pad > 0; pad--) {
+        dst[len++] = '0';
+    }
+    while (n > 0) {
+        dst[len++] = digits[--n];
+    }
+    return len;
+}
+
+bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Compresses a writer's output on its own thread. The writer hands over
+// each full buffer and carries on in the spare one, so compression of one
+// buffer overlaps rendering of the next and only two buffers exist.
+// gzip goes through zlib, so every build links -lz; zstd needs HAVE_ZSTD.
+typedef struct {
+    output_compression_t method;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *pending;                // buffer waiting for or being compressed
+    size_t pending_len;
+    char *spare;                  // compressed buffer returned to the writer
+    bool finishing;               // no more input: end the stream and exit
+    bool failed;
+    unsigned char *out;
+    size_t out_capacity;
+    z_stream gzip;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} output_compressor_t;
+
+// Compress one buffer (or, with finish, end the stream) and write the result
+bool compressor_run(output_compressor_t *c, const char *data, size_t len, bool finish) {
+    if (c->method == COMPRESS_GZIP) {
+        c->gzip.next_in = (Bytef *)data;
+        c->gzip.avail_in = (uInt)len;
+        int status;
+        do {
+            c->gzip.next_out = c->out;
+            c->gzip.avail_out = (uInt)c->out_capacity;
+            status = deflate(&c->gzip, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (status == Z_STREAM_ERROR) return false;
+            size_t produced = c->out_capacity - c->gzip.avail_out;
+            if (produced > 0 && !write_all(c->fd, (const char *)c->out, produced)) return false;
+        } while (c->gzip.avail_out == 0 || (finish && status != Z_STREAM_END));
+        return true;
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_inBuffer in = {data, len, 0};
+    size_t remaining;
+    do {
+        ZSTD_outBuffer out = {c->out, c->out_capacity, 0};
+        remaining = ZSTD_compressStream2(c->zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining)) return false;
+        if (out.pos > 0 && !write_all(c->fd, (const char *)c->out, out.pos)) return false;
+    } while (in.pos < in.size || (finish && remaining > 0));
+#endif
+    return true;
+}
+
+void *compressor_thread(void *arg) {
+    output_compressor_t *c = arg;
+    
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (!c->pending && !c->finishing) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        if (!c->pending) break;
+    
+        char *data = c->pending;
+        size_t len = c->pending_len;
+        bool failed = c->failed;
+        pthread_mutex_unlock(&c->lock);
+    
+        bool ok = failed || compressor_run(c, data, len, false);
+    
+        pthread_mutex_lock(&c->lock);
+        if (!ok) c->failed = true;
+        c->spare = data;
+        c->pending = NULL;
+        pthread_cond_broadcast(&c->cond);
+    }
+    bool failed = c->failed;
+    pthread_mutex_unlock(&c->lock);
+    
+    if (!failed && !compressor_run(c, NULL, 0, true)) {
+        pthread_mutex_lock(&c->lock);
+        c->failed = true;
+        pthread_mutex_unlock(&c->lock);
+    }
+    return NULL;
+}
+
+// Start compressing into fd; capacity is the size of the writer's buffers
+output_compressor_t *compressor_start(output_compression_t method, int fd, size_t capacity) {
+    output_compressor_t *c = calloc(1, sizeof(output_compressor_t));
+    if (!c) return NULL;
+    c->method = method;
+    c->fd = fd;
+    c->spare = malloc(capacity);
+    c->out_capacity = capacity;
+    c->out = malloc(c->out_capacity);
+    bool ok = c->spare && c->out;
+    
+    if (ok && method == COMPRESS_GZIP) {
+        // windowBits 15 + 16 selects the gzip wrapper
+        ok = deflateInit2(&c->gzip, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        if (!ok) c->method = COMPRESS_NONE;
+    }
+#ifdef HAVE_ZSTD
+    if (ok && method == COMPRESS_ZSTD) {
+        c->zstd = ZSTD_createCCtx();
+        ok = c->zstd != NULL;
+    }
+#endif
+    
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    if (ok && pthread_create(&c->thread, NULL, compressor_thread, c) == 0) return c;
+    
+    if (c->method == COMPRESS_GZIP) deflateEnd(&c->gzip);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c->spare);
+    free(c->out);
+    free(c);
+    return NULL;
+}
+
+// Hand buf over for compression; returns the buffer to continue in, or
+// NULL (leaving buf with the caller) once compressing or writing failed
+char *compressor_submit(output_compressor_t *c, char *buf, size_t len) {
+    pthread_mutex_lock(&c->lock);
+    while (c->pending) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (c->failed) {
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+    char *next = c->spare;
+    c->spare = NULL;
+    c->pending = buf;
+    c->pending_len = len;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return next;
+}
+
+// End the stream, wait for every byte to be written and free the
+// compressor; returns false if compressing or writing failed
+bool compressor_finish(output_compressor_t *c) {
+    pthread_mutex_lock(&c->lock);
+    c->finishing = true;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+    
+    bool ok = !c->failed;
+    if (c->method == COMPRESS_GZIP) deflateEnd(&c->gzip);
+#ifdef HAVE_ZSTD
+    if (c->method == COMPRESS_ZSTD) ZSTD_freeCCtx(c->zstd);
+#endif
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c->spare);
+    free(c->out);
+    free(c);
+    return ok;
+}
+
+// Buffered playlist output: entries are assembled with memcpy into one
+// large buffer that is flushed to the file descriptor with write(), or
+// handed to a compressor thread with --compress
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    output_compressor_t *compressor;
+    bool failed;
+} playlist_writer_t;
+
+bool playlist_writer_init(playlist_writer_t *w, int fd) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->capacity = WRITER_BUFFER_SIZE;
+    w->buf = malloc(w->capacity);
+    return w->buf != NULL;
+}
+
+// Compress everything written from here on; call right after init
+bool playlist_writer_compress(playlist_writer_t *w, output_compression_t method) {
+    if (method == COMPRESS_NONE) return true;
+    w->compressor = compressor_start(method, w->fd, w->capacity);
+    return w->compressor != NULL;
+}
+
+bool playlist_writer_flush(playlist_writer_t *w) {
+    if (w->fd < 0) return !w->failed;
+    if (w->len > 0 && !w->failed) {
+        if (w->compressor) {
+            char *next = compressor_submit(w->compressor, w->buf, w->len);
+            if (next) {
+                w->buf = next;
+            } else {
+                w->failed = true;
+            }
+        } else if (!write_all(w->fd, w->buf, w->len)) {
+            w->failed = true;
+        }
+    }
+    w->len = 0;
+    return !w->failed;
+}
+
+// Flush and release the buffer; returns false if any write failed
+bool playlist_writer_close(playlist_writer_t *w) {
+    bool ok = playlist_writer_flush(w);
+    if (w->compressor && !compressor_finish(w->compressor)) ok = false;
+    w->compressor = NULL;
+    free(w->buf);
+    w->buf = NULL;
+    return ok;
+}
+
+// Writer that accumulates output in a growing memory buffer (fd -1)
+bool playlist_writer_init_memory(playlist_writer_t *w) {
+    return playlist_writer_init(w, -1);
+}
+
+// Room for len more bytes at the end of the buffer, flushing or growing it
+// as needed. The caller fills it and advances w->len. Returns NULL if len
+// cannot fit even in an empty buffer, or a memory buffer failed to grow.
+char *writer_reserve(playlist_writer_t *w, size_t len) {
+    if (w->len + len > w->capacity && w->fd < 0) {
+        size_t capacity = w->capacity * 2 > w->len + len ? w->capacity * 2 : w->len + len;
+        char *buf = realloc(w->buf, capacity);
+        if (!buf) {
+            w->failed = true;
+            return NULL;
+        }
+        w->buf = buf;
+        w->capacity = capacity;
+    } else if (w->len + len > w->capacity) {
+        playlist_writer_flush(w);
+        if (len > w->capacity) return NULL;
+    }
+    return w->buf + w->len;
+}
+
+void writer_put(playlist_writer_t *w, const char *data, size_t len) {
+    char *p = writer_reserve(w, len);
+    if (p) {
+        memcpy(p, data, len);
+        w->len += len;
+    } else if (w->fd >= 0 && !w->failed && w->compressor) {
+        // Larger than a buffer: feed the compressor one buffer at a time
+        while (len > 0 && !w->failed) {
+            size_t n = len < w->capacity ? len : w->capacity;
+            p = writer_reserve(w, n);
+            memcpy(p, data, n);
+            w->len += n;
+            data += n;
+            len -= n;
+        }
+    } else if (w->fd >= 0 && !w->failed && !write_all(w->fd, data, len)) {
+        w->failed = true;
+    }
+}
+
+void writer_puts(playlist_writer_t *w, const char *s) {
+    writer_put(w, s, strlen(s));
+}
+
+void writer_put_int(playlist_writer_t *w, int number) {
+    char digits[16];
+    writer_put(w, digits, format_index(digits, number, 0));
+}
+
+#define WRITER_LITERAL(w, s) writer_put((w), (s), sizeof(s) - 1)
+
+// Where a PLS header's NumberOfEntries comes from
+typedef enum {
+    PLS_COUNT_KNOWN,              // every entry is written, so the count is the total
+    PLS_COUNT_RESERVED,           // zero-padded digits that are overwritten at the end
+    PLS_COUNT_TRAILER             // left to the footer, for output that is never written back to
+} pls_count_t;
+
+// Write the header of a new playlist. With PLS_COUNT_RESERVED the PLS count
+// is written zero-padded to PLS_COUNT_WIDTH digits so the real count can be
+// stored over it once known; returns the field's offset in the output, or
+// -1 if no field was reserved. The header must be the writer's first output.
+long write_playlist_header(playlist_writer_t *w, playlist_format_t format, int total_entries, pls_count_t count) {
+    long count_offset = -1;
+    switch (format) {
+        case FORMAT_M3U:
+        case FORMAT_M3U8:
+            WRITER_LITERAL(w, "#EXTM3U\n");
+            break;
+        case FORMAT_PLS:
+            WRITER_LITERAL(w, "[playlist]\n");
+            if (count == PLS_COUNT_TRAILER) break;
+            WRITER_LITERAL(w, "NumberOfEntries=");
+            if (count == PLS_COUNT_RESERVED) {
+                count_offset = (long)w->len;
+                char digits[PLS_COUNT_WIDTH];
+                writer_put(w, digits, format_index(digits, total_entries, PLS_COUNT_WIDTH));
+            } else {
+                writer_put_int(w, total_entries);
+            }
+            WRITER_LITERAL(w, "\nVersion=2\n\n");
+            break;
+        case FORMAT_XSPF:
+            WRITER_LITERAL(w, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+            WRITER_LITERAL(w, "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n");
+            WRITER_LITERAL(w, "  <trackList>\n");
+            break;
+        default:
+            break;
+    }
+    return count_offset;
+}
+
+// trailing_count is the PLS count of a PLS_COUNT_TRAILER header, else -1
+void write_playlist_footer(playlist_writer_t *w, playlist_format_t format, int trailing_count) {
+    if (format == FORMAT_PLS && trailing_count >= 0) {
+        WRITER_LITERAL(w, "NumberOfEntries=");
+        writer_put_int(w, trailing_count);
+        WRITER_LITERAL(w, "\nVersion=2\n");
+    } else if (format == FORMAT_XSPF) {
+        WRITER_LITERAL(w, "  </trackList>\n");
+        WRITER_LITERAL(w, "</playlist>\n");
+    }
+}
+
+// Characters that cannot appear as-is in entry text: XML specials inside
+// XSPF elements, and line breaks in the line-based formats
+static const char xml_special_chars[TEXT_SCAN_SET] = {'&', '<', '>', '"', '\''};
+static const char line_break_chars[TEXT_SCAN_SET] = {'\r', '\n', '\n', '\n', '\n'};
+
+// Offset of the first byte of s[0, len) found in set, or len if none
+size_t text_scan_scalar(const char *s, size_t len, const char *set) {
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == set[0] || c == set[1] || c == set[2] || c == set[3] || c == set[4]) return i;
+    }
+    return len;
+}
+
+#ifdef TEXT_SCAN_X86
+// 16 bytes per step: compare against each character of set and stop at
+// the first block with a match
+size_t text_scan_sse2(const char *s, size_t len, const char *set) {
+    __m128i c0 = _mm_set1_epi8(set[0]);
+    __m128i c1 = _mm_set1_epi8(set[1]);
+    __m128i c2 = _mm_set1_epi8(set[2]);
+    __m128i c3 = _mm_set1_epi8(set[3]);
+    __m128i c4 = _mm_set1_epi8(set[4]);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, c1)),
+                                   _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(v, c3)),
+                                                _mm_cmpeq_epi8(v, c4)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + text_scan_scalar(s + i, len - i, set);
+}
+
+// Same scan 32 bytes at a time, for CPUs that report AVX2 at run time
+__attribute__((target("avx2")))
+size_t text_scan_avx2(const char *s, size_t len, const char *set) {
+    __m256i c0 = _mm256_set1_epi8(set[0]);
+    __m256i c1 = _mm256_set1_epi8(set[1]);
+    __m256i c2 = _mm256_set1_epi8(set[2]);
+    __m256i c3 = _mm256_set1_epi8(set[3]);
+    __m256i c4 = _mm256_set1_epi8(set[4]);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, c1)),
+                                      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, c2),
+                                                                      _mm256_cmpeq_epi8(v, c3)),
+                                                      _mm256_cmpeq_epi8(v, c4)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    // The tail stays in this function: calling the SSE2 scanner with the
+    // upper register halves dirty costs more than the scalar loop
+    return i + text_scan_scalar(s + i, len - i, set);
+}
+
+size_t (*text_scan)(const char *s, size_t len, const char *set) = text_scan_sse2;
+#else
+size_t (*text_scan)(const char *s, size_t len, const char *set) = text_scan_scalar;
+#endif
+
+// Pick the widest scanner the CPU supports; call before any output is written
+void text_scan_init(void) {
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) text_scan = text_scan_avx2;
+#endif
+}
+
+// Text with the XML special characters replaced by entities. Clean runs
+// between specials are found by text_scan and copied in bulk; dst needs
+// room for six bytes per input byte.
+size_t entry_put_xml(char *dst, const char *s, size_t len) {
+    char *p = dst;
+    for (;;) {
+        size_t run = text_scan(s, len, xml_special_chars);
+        memcpy(p, s, run);
+        p += run;
+        if (run == len) return (size_t)(p - dst);
+        
+        const char *entity;
+        size_t entity_len;
+        switch (s[run]) {
+            case '&': entity = "&amp;"; entity_len = 5; break;
+            case '<': entity = "&lt;"; entity_len = 4; break;
+            case '>': entity = "&gt;"; entity_len = 4; break;
+            case '"': entity = "&quot;"; entity_len = 6; break;
+            default: entity = "&apos;"; entity_len = 6; break;
+        }
+        memcpy(p, entity, entity_len);
+        p += entity_len;
+        s += run + 1;
+        len -= run + 1;
+    }
+}
+
+// URL for a line-based playlist: CR and LF would end the entry early, so
+// they are percent-encoded. dst needs room for three bytes per input byte.
+size_t entry_put_line_url(char *dst, const char *s, size_t len) {
+    char *p = dst;
+    for (;;) {
+        size_t run = text_scan(s, len, line_break_chars);
+        memcpy(p, s, run);
+        p += run;
+        if (run == len) return (size_t)(p - dst);
+        
+        memcpy(p, s[run] == '\r' ? "%0D" : "%0A", 3);
+        p += 3;
+        s += run + 1;
+        len -= run + 1;
+    }
+}
+
+// Entry layout compiled once per playlist: literal text, with the -P/-S
+// text folded in, interleaved with slots that are filled for each entry.
+// Unverified runs have no media, so their titles and lengths compile to
+// literals around the index and the hot loop is nothing but memcpy.
+typedef enum {
+    SLOT_END,                     // nothing after the last literal
+    SLOT_URL,
+    SLOT_NUMBER,                  // PLS entry number
+    SLOT_INDEX,                   // template index of the default "Track N" title
+    SLOT_TITLE,                   // "Artist - Title" from the probe, else "Track N"
+    SLOT_SECONDS,                 // duration in whole seconds, -1 if unknown
+    SLOT_XML_TITLE,               // XSPF <title> text
+    SLOT_XSPF_MEDIA               // XSPF <creator> and <duration> elements when known
+} entry_slot_t;
+
+typedef struct {
+    size_t literal_offset;        // literal text before the slot, in entry_format_t.text
+    size_t literal_len;
+    entry_slot_t slot;
+} entry_segment_t;
+
+typedef struct {
+    char *text;                   // every segment's literal text
+    size_t text_len;
+    size_t text_capacity;
+    entry_segment_t segments[ENTRY_MAX_SEGMENTS];
+    int count;
+    int url_slots;
+    int digit_slots;              // number, index and seconds slots, 11 bytes at most
+    int media_slots;              // title and XSPF media slots, ENTRY_MEDIA_BOUND bytes at most
+    bool xml_urls;                // XSPF: URLs are entity-escaped, else only line breaks are encoded
+    bool escape_urls;             // the template has text that needs escaping; digits never do
+    bool needs_number;
+    bool needs_index;
+    bool failed;
+} entry_format_t;
+
+void entry_format_literal(entry_format_t *f, const char *text, size_t len) {
+    if (f->text_len + len > f->text_capacity) {
+        size_t capacity = f->text_capacity * 2 > f->text_len + len ? f->text_capacity * 2 : f->text_len + len + 64;
+        char *grown = realloc(f->text, capacity);
+        if (!grown) {
+            f->failed = true;
+            return;
+        }
+        f->text = grown;
+        f->text_capacity = capacity;
+    }
+    memcpy(f->text + f->text_len, text, len);
+    f->text_len += len;
+    f->segments[f->count].literal_len += len;
+}
+
+#define ENTRY_LITERAL(f, s) entry_format_literal((f), (s), sizeof(s) - 1)
+
+// End the current segment with slot and start the next one
+void entry_format_slot(entry_format_t *f, entry_slot_t slot) {
+    f->segments[f->count].slot = slot;
+    switch (slot) {
+        case SLOT_URL: f->url_slots++; break;
+        case SLOT_NUMBER: f->digit_slots++; f->needs_number = true; break;
+        case SLOT_INDEX: f->digit_slots++; f->needs_index = true; break;
+        case SLOT_SECONDS: f->digit_slots++; break;
+        case SLOT_TITLE:
+        case SLOT_XML_TITLE: f->media_slots++; f->needs_index = true; break;
+        case SLOT_XSPF_MEDIA: f->media_slots++; break;
+        case SLOT_END: break;
+    }
+    f->count++;
+    f->segments[f->count].literal_offset = f->text_len;
+    f->segments[f->count].literal_len = 0;
+}
+
+// -P/-S text goes through the same escaping as the URL it surrounds
+void entry_format_url_literal(entry_format_t *f, const char *text) {
+    size_t len = strlen(text);
+    char *escaped = malloc(len * 6 + 1);
+    if (!escaped) {
+        f->failed = true;
+        return;
+    }
+    size_t escaped_len = f->xml_urls ? entry_put_xml(escaped, text, len) : entry_put_line_url(escaped, text, len);
+    entry_format_literal(f, escaped, escaped_len);
+    free(escaped);
+}
+
+void entry_format_url(entry_format_t *f, const char *prefix, const char *suffix) {
+    entry_format_url_literal(f, prefix);
+    entry_format_slot(f, SLOT_URL);
+    entry_format_url_literal(f, suffix);
+}
+
+void entry_format_title(entry_format_t *f, bool media, entry_slot_t slot) {
+    if (media) {
+        entry_format_slot(f, slot);
+    } else {
+        ENTRY_LITERAL(f, "Track ");
+        entry_format_slot(f, SLOT_INDEX);
+    }
+}
+
+void entry_format_seconds(entry_format_t *f, bool media) {
+    if (media) {
+        entry_format_slot(f, SLOT_SECONDS);
+    } else {
+        ENTRY_LITERAL(f, "-1");
+    }
+}
+
+// Compile the entry layout of format; media adds the slots that verified
+// runs fill from probe results. prefix and suffix are the -P/-S text, and
+// link_template the template every URL is built from: only its literal
+// text can need escaping, so it is scanned here rather than per entry.
+bool entry_format_compile(entry_format_t *f, playlist_format_t format, const char *link_template,
+                          const char *prefix, const char *suffix, bool media) {
+    memset(f, 0, sizeof(*f));
+    if (!prefix) prefix = "";
+    if (!suffix) suffix = "";
+    f->xml_urls = format == FORMAT_XSPF;
+    size_t template_len = strlen(link_template);
+    f->escape_urls = text_scan(link_template, template_len,
+                               f->xml_urls ? xml_special_chars : line_break_chars) < template_len;
+    
+    switch (format) {
+        case FORMAT_M3U:
+        case FORMAT_M3U8:
+            ENTRY_LITERAL(f, "#EXTINF:");
+            entry_format_seconds(f, media);
+            ENTRY_LITERAL(f, ",");
+            entry_format_title(f, media, SLOT_TITLE);
+            ENTRY_LITERAL(f, "\n");
+            entry_format_url(f, prefix, suffix);
+            ENTRY_LITERAL(f, "\n");
+            break;
+        case FORMAT_PLS:
+            ENTRY_LITERAL(f, "File");
+            entry_format_slot(f, SLOT_NUMBER);
+            ENTRY_LITERAL(f, "=");
+            entry_format_url(f, prefix, suffix);
+            ENTRY_LITERAL(f, "\nTitle");
+            entry_format_slot(f, SLOT_NUMBER);
+            ENTRY_LITERAL(f, "=");
+            entry_format_title(f, media, SLOT_TITLE);
+            ENTRY_LITERAL(f, "\nLength");
+            entry_format_slot(f, SLOT_NUMBER);
+            ENTRY_LITERAL(f, "=");
+            entry_format_seconds(f, media);
+            ENTRY_LITERAL(f, "\n\n");
+            break;
+        case FORMAT_XSPF:
+            ENTRY_LITERAL(f, "    <track>\n      <location>");
+            entry_format_url(f, prefix, suffix);
+            ENTRY_LITERAL(f, "</location>\n      <title>");
+            entry_format_title(f, media, SLOT_XML_TITLE);
+            ENTRY_LITERAL(f, "</title>\n");
+            if (media) entry_format_slot(f, SLOT_XSPF_MEDIA);
+            ENTRY_LITERAL(f, "    </track>\n");
+            break;
+        default:
+            entry_format_url(f, prefix, suffix);
+            ENTRY_LITERAL(f, "\n");
+            break;
+    }
+    entry_format_slot(f, SLOT_END);
+    return !f->failed;
+}
+
+void entry_format_free(entry_format_t *f) {
+    free(f->text);
+    f->text = NULL;
+}
+
+size_t entry_put_text(char *dst, const char *s) {
+    size_t len = strlen(s);
+    memcpy(dst, s, len);
+    return len;
+}
+
+// Write one entry: number is its PLS entry number, index its template
+// index, and media what verification learned (NULL for unverified runs).
+// The entry is rendered straight into the writer's buffer.
+void entry_format_write(playlist_writer_t *w, const entry_format_t *f, const char *url,
+                        int number, int index, const media_info_t *media) {
+    size_t url_len = strlen(url);
+    char number_digits[16];
+    char index_digits[16];
+    size_t number_len = f->needs_number ? format_index(number_digits, number, 0) : 0;
+    size_t index_len = f->needs_index ? format_index(index_digits, index, 0) : 0;
+    
+    size_t url_bound = !f->escape_urls ? url_len : url_len * (f->xml_urls ? 6 : 3);
+    size_t bound = f->text_len + f->url_slots * url_bound + f->digit_slots * 11 +
+                   f->media_slots * ENTRY_MEDIA_BOUND;
+    char *out = writer_reserve(w, bound);
+    char *spill = NULL;
+    if (!out) {
+        // Bigger than the whole buffer (long -P/-S text): render it on the side
+        if (w->fd < 0 || w->failed) return;
+        spill = malloc(bound);
+        if (!spill) {
+            w->failed = true;
+            return;
+        }
+        out = spill;
+    }
+    
+    char *p = out;
+    for (int k = 0; k < f->count; k++) {
+        const entry_segment_t *seg = &f->segments[k];
+        memcpy(p, f->text + seg->literal_offset, seg->literal_len);
+        p += seg->literal_len;
+        switch (seg->slot) {
+            case SLOT_URL:
+                if (!f->escape_urls) {
+                    memcpy(p, url, url_len);
+                    p += url_len;
+                } else {
+                    p += f->xml_urls ? entry_put_xml(p, url, url_len) : entry_put_line_url(p, url, url_len);
+                }
+                break;
+            case SLOT_NUMBER:
+                memcpy(p, number_digits, number_len);
+                p += number_len;
+                break;
+            case SLOT_INDEX:
+                memcpy(p, index_digits, index_len);
+                p += index_len;
+                break;
+            case SLOT_TITLE:
+                if (media && media->title[0]) {
+                    if (media->artist[0]) {
+                        p += entry_put_text(p, media->artist);
+                        memcpy(p, " - ", 3);
+                        p += 3;
+                    }
+                    p += entry_put_text(p, media->title);
+                    break;
+                }
+                memcpy(p, "Track ", 6);
+                memcpy(p + 6, index_digits, index_len);
+                p += 6 + index_len;
+                break;
+            case SLOT_SECONDS:
+                if (media && media->duration_ms >= 0) {
+                    p += format_index(p, (media->duration_ms + 500) / 1000, 0);
+                } else {
+                    memcpy(p, "-1", 2);
+                    p += 2;
+                }
+                break;
+            case SLOT_XML_TITLE:
+                if (media && media->title[0]) {
+                    p += entry_put_xml(p, media->title, strlen(media->title));
+                    break;
+                }
+                memcpy(p, "Track ", 6);
+                memcpy(p + 6, index_digits, index_len);
+                p += 6 + index_len;
+                break;
+            case SLOT_XSPF_MEDIA:
+                if (media && media->artist[0]) {
+                    p += entry_put_text(p, "      <creator>");
+                    p += entry_put_xml(p, media->artist, strlen(media->artist));
+                    p += entry_put_text(p, "</creator>\n");
+                }
+                if (media && media->duration_ms >= 0) {
+                    p += entry_put_text(p, "      <duration>");
+                    p += format_index(p, media->duration_ms, 0);
+                    p += entry_put_text(p, "</duration>\n");
+                }
+                break;
+            case SLOT_END:
+                break;
+        }
+    }
+    
+    if (spill) {
+        writer_put(w, spill, p - spill);
+        free(spill);
+    } else {
+        w->len += p - out;
+    }
+}
+
+// Rate limit for progress output: the clock is read every stride calls,
+// and a snapshot is due once PROGRESS_INTERVAL_MS have passed, so huge
+// unverified runs are not slowed down by terminal writes
+typedef struct {
+    struct timespec last;
+    int stride;
+    int countdown;
+} progress_meter_t;
+
+void progress_meter_init(progress_meter_t *m, int stride) {
+    clock_gettime(CLOCK_MONOTONIC, &m->last);
+    m->stride = stride;
+    m->countdown = stride;
+}
+
+bool progress_meter_due(progress_meter_t *m) {
+    if (--m->countdown > 0) return false;
+    m->countdown = m->stride;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed_ms = (now.tv_sec - m->last.tv_sec) * 1000LL + (now.tv_nsec - m->last.tv_nsec) / 1000000;
+    if (elapsed_ms < PROGRESS_INTERVAL_MS) return false;
+    m->last = now;
+    return true;
+}
+
+// --events ndjson: one JSON object per line on a separate fd, for
+// orchestrators. Lines collect in a writer buffer that is flushed with
+// each progress snapshot rather than written one by one.
+typedef struct {
+    playlist_writer_t out;
+    struct timespec started;
+} event_stream_t;
+
+bool event_stream_open(event_stream_t *e, int fd) {
+    clock_gettime(CLOCK_MONOTONIC, &e->started);
+    return playlist_writer_init(&e->out, fd);
+}
+
+// JSON string contents; dst needs room for six bytes per input byte
+size_t entry_put_json(char *dst, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    char *p = dst;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            *p++ = (char)c;
+        } else if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 15];
+            p += 6;
+        }
+    }
+    return (size_t)(p - dst);
+}
+
+// Result of one verified entry; job is its manifest line, 0 for the command line
+void event_stream_result(event_stream_t *e, int job, const url_check_t *check) {
+    size_t url_len = strlen(check->url);
+    char *p = writer_reserve(&e->out, url_len * 6 + 256);
+    if (!p) return;
+    
+    char *start = p;
+    p += sprintf(p, "{\"event\":\"result\",\"job\":%d,\"index\":%d,\"url\":\"", job, check->index);
+    p += entry_put_json(p, check->url, url_len);
+    p += sprintf(p, "\",\"valid\":%s,\"status\":%ld,\"latency_ms\":%.3f,\"cached\":%s}\n",
+                 check->is_valid ? "true" : "false", check->status, check->latency_us / 1000.0,
+                 check->from_cache ? "true" : "false");
+    e->out.len += p - start;
+}
+
+// Progress snapshot; also pushes out the results batched since the last one
+void event_stream_progress(event_stream_t *e, long long done, long long total, int valid, int invalid) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - e->started.tv_sec) + (now.tv_nsec - e->started.tv_nsec) / 1e9;
+    
+    char *p = writer_reserve(&e->out, 256);
+    if (!p) return;
+    e->out.len += sprintf(p, "{\"event\":\"progress\",\"done\":%lld,\"total\":%lld,\"valid\":%d,\"invalid\":%d,"
+                          "\"elapsed\":%.3f}\n", done, total, valid, invalid, elapsed);
+    playlist_writer_flush(&e->out);
+}
+
+// Final summary; returns false if any event could not be written
+bool event_stream_close(event_stream_t *e, int jobs, int failed, int valid, int invalid) {
+    char *p = writer_reserve(&e->out, 256);
+    if (p) {
+        e->out.len += sprintf(p, "{\"event\":\"summary\",\"jobs\":%d,\"failed\":%d,\"valid\":%d,\"invalid\":%d}\n",
+                              jobs, failed, valid, invalid);
+    }
+    return playlist_writer_close(&e->out);
+}
+
+// Checkpoint journal for --journal/--resume: a header identifying the run
+// followed by one fixed-size record per consumed entry, appended in
+// playlist order. Records are flushed and fdatasync'd every
+// JOURNAL_SYNC_ENTRIES, so a killed run loses at most the last batch.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t template_hash;       // FNV-1a hash of the template
+    int32_t start;
+    int32_t padding;
+} journal_header_t;
+
+typedef struct {
+    int32_t index;
+    int32_t status;
+    uint8_t is_valid;
+    uint8_t reserved[3];
+    int32_t duration_ms;
+    char title[MEDIA_TITLE_LENGTH];
+    char artist[MEDIA_ARTIST_LENGTH];
+} journal_record_t;
+
+typedef struct {
+    char *path;
+    journal_header_t header;
+    int fd;                       // -1 when not journaling
+    playlist_writer_t out;
+    int unsynced;
+    journal_record_t *replay;     // records of the interrupted run, for --resume
+    int replay_count;
+} checkpoint_journal_t;
+
+// Journal of the job in config, next to its output; the header is fixed
+// here, before --resume moves the start of the range
+bool journal_init(checkpoint_journal_t *journal, const config_t *config) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    memcpy(journal->header.magic, JOURNAL_MAGIC, 4);
+    journal->header.version = JOURNAL_VERSION;
+    journal->header.template_hash = hash_url(config->link_template);
+    journal->header.start = config->start;
+    journal->header.padding = config->padding;
+    
+    size_t len = strlen(config->playlist_file) + sizeof(".journal");
+    journal->path = malloc(len);
+    if (!journal->path) return false;
+    snprintf(journal->path, len, "%s.journal", config->playlist_file);
+    return true;
+}
+
+// Read the records a previous run of the same job left behind. A missing
+// journal is not an error: there is nothing to resume. A torn record at
+// the end, from a run killed mid-write, is dropped.
+bool journal_load(checkpoint_journal_t *journal) {
+    int fd = open(journal->path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT;
+    
+    struct stat st;
+    journal_header_t header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(&header, &journal->header, sizeof(header)) != 0) {
+        close(fd);
+        fprintf(stderr, "Error: Journal '%s' belongs to a different run.\n", journal->path);
+        return false;
+    }
+    
+    size_t count = ((size_t)st.st_size - sizeof(header)) / sizeof(journal_record_t);
+    journal->replay = malloc(count ? count * sizeof(journal_record_t) : 1);
+    bool ok = journal->replay != NULL;
+    if (ok && count > 0) {
+        ok = pread(fd, journal->replay, count * sizeof(journal_record_t), sizeof(header)) ==
+             (ssize_t)(count * sizeof(journal_record_t));
+    }
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to read journal '%s'.\n", journal->path);
+        return false;
+    }
+    journal->replay_count = (int)count;
+    return true;
+}
+
+// Start journaling: after a replay the kept records are extended, otherwise
+// the journal starts over with a fresh header
+bool journal_open(checkpoint_journal_t *journal) {
+    off_t keep = journal->replay_count > 0 ?
+                 (off_t)(sizeof(journal_header_t) + (size_t)journal->replay_count * sizeof(journal_record_t)) : 0;
+    
+    int fd = open(journal->path, O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, keep) != 0 || lseek(fd, keep, SEEK_SET) < 0 ||
+        (!keep && !write_all(fd, (const char *)&journal->header, sizeof(journal->header))) ||
+        !playlist_writer_init(&journal->out, fd)) {
+        close(fd);
+        return false;
+    }
+    journal->fd = fd;
+    journal->unsynced = 0;
+    return true;
+}
+
+bool journal_sync(checkpoint_journal_t *journal) {
+    bool ok = playlist_writer_flush(&journal->out) && fdatasync(journal->fd) == 0;
+    journal->unsynced = 0;
+    return ok;
+}
+
+void journal_record_init(journal_record_t *record, const url_check_t *check) {
+    memset(record, 0, sizeof(*record));
+    record->index = check->index;
+    record->status = (int32_t)check->status;
+    record->is_valid = check->is_valid;
+    record->duration_ms = check->media.duration_ms;
+    memcpy(record->title, check->media.title, sizeof(record->title));
+    memcpy(record->artist, check->media.artist, sizeof(record->artist));
+}
+
+void journal_append(checkpoint_journal_t *journal, const url_check_t *check) {
+    journal_record_t record;
+    journal_record_init(&record, check);
+    writer_put(&journal->out, (const char *)&record, sizeof(record));
+    if (++journal->unsynced >= JOURNAL_SYNC_ENTRIES) journal_sync(journal);
+}
+
+// Stop journaling; with done the run finished and the journal is removed
+void journal_close(checkpoint_journal_t *journal, bool done) {
+    if (journal->fd >= 0) {
+        journal_sync(journal);
+        playlist_writer_close(&journal->out);
+        close(journal->fd);
+        journal->fd = -1;
+        if (done) unlink(journal->path);
+    }
+    free(journal->replay);
+    journal->replay = NULL;
+    journal->replay_count = 0;
+}
+
+void journal_free(checkpoint_journal_t *journal) {
+    journal_close(journal, false);
+    free(journal->path);
+    journal->path = NULL;
+}
+
+// --shard K/N output: a header naming the shard and the whole sweep, the
+// template text, then one journal record per verified entry of the
+// shard's block, valid or not. "lkvad merge" renders a full set of shards
+// into one playlist.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t shard;               // K, from 1
+    uint32_t shards;              // N
+    int32_t start;                // the whole sweep, identical in every shard
+    int32_t end;
+    int32_t padding;
+    uint32_t template_len;        // template bytes that follow the header
+    uint32_t flags;               // SHARD_STOPPED, set when the shard is closed
+} shard_header_t;
+
+// Narrow config's range to block K of N. Blocks are contiguous so merging
+// is concatenation in shard order; sizes differ by at most one entry.
+void shard_partition(config_t *config, int shard, int shards) {
+    long long total = (long long)config->end - config->start + 1;
+    int first = config->start + (int)(total * (shard - 1) / shards);
+    int last = config->start + (int)(total * shard / shards) - 1;
+    config->start = first;
+    config->end = last;
+}
+
+bool write_shard_header(playlist_writer_t *w, const config_t *config, int start, int end) {
+    shard_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARD_MAGIC, 4);
+    header.version = SHARD_VERSION;
+    header.shard = (uint32_t)config->shard;
+    header.shards = (uint32_t)config->shards;
+    header.start = start;
+    header.end = end;
+    header.padding = config->padding;
+    header.template_len = (uint32_t)strlen(config->link_template);
+    writer_put(w, (const char *)&header, sizeof(header));
+    writer_put(w, config->link_template, header.template_len);
+    return !w->failed;
+}
+
+typedef struct {
+    shard_header_t header;
+    char *template_text;
+    journal_record_t *records;
+    int count;
+} shard_file_t;
+
+// Read a whole shard file; records of a shard that was cut short are
+// kept up to the last complete one, and merge_main checks what is missing
+bool shard_file_read(shard_file_t *shard, const char *path) {
+    memset(shard, 0, sizeof(*shard));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open shard '%s'.\n", path);
+        return false;
+    }
+    
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 &&
+              pread(fd, &shard->header, sizeof(shard->header), 0) == (ssize_t)sizeof(shard->header) &&
+              memcmp(shard->header.magic, SHARD_MAGIC, 4) == 0 && shard->header.version == SHARD_VERSION &&
+              shard->header.shards > 0 && shard->header.shard >= 1 && shard->header.shard <= shard->header.shards &&
+              (size_t)st.st_size >= sizeof(shard->header) + shard->header.template_len;
+    if (!ok) {
+        close(fd);
+        fprintf(stderr, "Error: '%s' is not a shard file.\n", path);
+        return false;
+    }
+    
+    size_t records_offset = sizeof(shard->header) + shard->header.template_len;
+    size_t count = ((size_t)st.st_size - records_offset) / sizeof(journal_record_t);
+    size_t partial = ((size_t)st.st_size - records_offset) % sizeof(journal_record_t);
+    if (partial > 0) {
+        fprintf(stderr, "Warning: Shard '%s' ends in a partial record; ignoring its last %zu bytes.\n",
+                path, partial);
+    }
+    shard->template_text = malloc(shard->header.template_len + 1);
+    shard->records = malloc(count ? count * sizeof(journal_record_t) : 1);
+    ok = shard->template_text && shard->records &&
+         pread(fd, shard->template_text, shard->header.template_len, sizeof(shard->header)) ==
+         (ssize_t)shard->header.template_len &&
+         (count == 0 || pread(fd, shard->records, count * sizeof(journal_record_t), records_offset) ==
+                        (ssize_t)(count * sizeof(journal_record_t)));
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to read shard '%s'.\n", path);
+        return false;
+    }
+    shard->template_text[shard->header.template_len] = '\0';
+    shard->count = (int)count;
+    return true;
+}
+
+// Whether a shard's records reach the last index of its block, or it
+// stopped early on --stop-after-misses. *reached is its last index.
+bool shard_file_complete(const shard_file_t *shard, int *first, int *last, int *reached) {
+    config_t block;
+    memset(&block, 0, sizeof(block));
+    block.start = shard->header.start;
+    block.end = shard->header.end;
+    shard_partition(&block, (int)shard->header.shard, (int)shard->header.shards);
+    *first = block.start;
+    *last = block.end;
+    *reached = shard->count > 0 ? shard->records[shard->count - 1].index : block.start - 1;
+    return *reached >= block.end || (shard->header.flags & SHARD_STOPPED);
+}
+
+void shard_file_free(shard_file_t *shard) {
+    free(shard->template_text);
+    free(shard->records);
+    memset(shard, 0, sizeof(*shard));
+}
+
+// Reusable URL buffer: the template prefix is written once and only the
+// digits and suffix are rewritten for each index
+typedef struct {
+    char *buf;
+    size_t capacity;
+    size_t prefix_len;
+    const char *suffix;
+    size_t suffix_len;
+    int padding;
+    const struct url_template *tmpl;  // multi-placeholder template, NULL for a single *
+    int values[TEMPLATE_MAX_DIMS];     // placeholder values currently in buf
+    size_t offsets[TEMPLATE_MAX_DIMS]; // where each placeholder's digits start in buf
+    bool formatted;
+} url_builder_t;
+
+// Bytes a builder needs to hold every URL of the template without truncation
+size_t url_builder_size(const char *prefix, const char *suffix, int padding) {
+    size_t digits = padding > 11 ? (size_t)padding : 11;
+    size_t size = strlen(prefix) + digits + strlen(suffix) + 1;
+    return size < MAX_URL_LENGTH ? size : MAX_URL_LENGTH;
+}
+
+void url_builder_init(url_builder_t *ub, char *buf, size_t capacity,
+                      const char *prefix, const char *suffix, int padding) {
+    ub->buf = buf;
+    ub->capacity = capacity;
+    ub->prefix_len = strlen(prefix);
+    if (ub->prefix_len > capacity - 1) ub->prefix_len = capacity - 1;
+    memcpy(buf, prefix, ub->prefix_len);
+    buf[ub->prefix_len] = '\0';
+    ub->suffix = suffix;
+    ub->suffix_len = strlen(suffix);
+    ub->padding = padding;
+    ub->tmpl = NULL;
+}
+
+const char *url_builder_format_template(url_builder_t *ub, int ordinal);
+
+// Render the URL for number into the builder's buffer and return it
+const char *url_builder_format(url_builder_t *ub, int number) {
+    if (ub->tmpl) return url_builder_format_template(ub, number);
+    size_t room = ub->capacity - 1 - ub->prefix_len;
+    char *p = ub->buf + ub->prefix_len;
+    size_t len;
+    
+    if (room >= 11 && room >= (size_t)ub->padding) {
+        len = format_index(p, number, ub->padding);
+    } else {
+        char digits[MAX_URL_LENGTH];
+        len = format_index(digits, number, ub->padding > MAX_URL_LENGTH - 1 ? MAX_URL_LENGTH - 1 : ub->padding);
+        if (len > room) len = room;
+        memcpy(p, digits, len);
+    }
+    room -= len;
+    
+    size_t suffix_len = ub->suffix_len < room ? ub->suffix_len : room;
+    memcpy(p + len, ub->suffix, suffix_len);
+    p[len + suffix_len] = '\0';
+    return ub->buf;
+}
+
+char *generate_url(const char *prefix, const char *suffix, int number, int padding) {
+    size_t size = url_builder_size(prefix, suffix, padding);
+    char *url = malloc(size);
+    if (!url) return NULL;
+    
+    url_builder_t ub;
+    url_builder_init(&ub, url, size, prefix, suffix, padding);
+    url_builder_format(&ub, number);
+    return url;
+}
+
+// One placeholder of a multi-placeholder template: {start..end}, or
+// {start..end:width} zero-padded to width, or a bare * taking -s/-e/-z
+typedef struct {
+    const char *literal;          // text between the previous placeholder and this one
+    size_t literal_len;
+    int start;
+    int end;
+    int padding;
+} template_dim_t;
+
+// Template with several placeholders, expanded in row-major order with
+// the last placeholder varying fastest. Entries are numbered 1..total and
+// decoded on demand, so the cartesian product is never materialized. A
+// row is one combination of every placeholder but the last.
+typedef struct url_template {
+    template_dim_t dims[TEMPLATE_MAX_DIMS];
+    int count;
+    const char *tail;             // text after the last placeholder
+    size_t tail_len;
+    char *text;                   // owned copy of the template the literals point into
+    long long rows;
+    long long total;
+    long long *row_offsets;       // --discover: entries before each row, rows + 1 values; NULL if rows are full
+} url_template_t;
+
+// Parse a {start..end} or {start..end:width} placeholder at p. Returns the
+// character after the closing brace, or NULL if p does not start one.
+const char *parse_placeholder(const char *p, int *start, int *end, int *padding) {
+    if (*p != '{' || !isdigit((unsigned char)p[1])) return NULL;
+    char *q;
+    long first = strtol(p + 1, &q, 10);
+    if (strncmp(q, "..", 2) != 0 || !isdigit((unsigned char)q[2])) return NULL;
+    long last = strtol(q + 2, &q, 10);
+    long width = 0;
+    if (*q == ':') {
+        if (!isdigit((unsigned char)q[1])) return NULL;
+        width = strtol(q + 1, &q, 10);
+    }
+    if (*q != '}' || first > INT_MAX || last > INT_MAX || width > MAX_URL_LENGTH) return NULL;
+    *start = (int)first;
+    *end = (int)last;
+    *padding = (int)width;
+    return q + 1;
+}
+
+// A template needs the multi-placeholder path if it has a {a..b} placeholder or several *
+bool template_is_multi(const char *text) {
+    int stars = 0;
+    for (const char *p = text; *p; p++) {
+        int start, end, padding;
+        if (*p == '*') stars++;
+        if (parse_placeholder(p, &start, &end, &padding)) return true;
+    }
+    return stars > 1;
+}
+
+void url_template_free(url_template_t *t) {
+    free(t->text);
+    free(t->row_offsets);
+}
+
+// Split t->text into literals and placeholders; url_template_parse frees
+// the template if this fails
+bool url_template_split(url_template_t *t, const config_t *config) {
+    bool from_star[TEMPLATE_MAX_DIMS];
+    const char *literal = t->text;
+    size_t url_len = 0;
+    for (const char *p = t->text; *p; ) {
+        int start, end, padding;
+        const char *next = *p == '*' ? p + 1 : parse_placeholder(p, &start, &end, &padding);
+        if (!next) {
+            p++;
+            continue;
+        }
+        if (t->count == TEMPLATE_MAX_DIMS) {
+            fprintf(stderr, "Error: Templates support at most %d placeholders.\n", TEMPLATE_MAX_DIMS);
+            return false;
+        }
+        from_star[t->count] = *p == '*';
+        if (*p == '*') {
+            start = config->start;
+            end = config->end;
+            padding = config->padding;
+        }
+        
+        template_dim_t *dim = &t->dims[t->count++];
+        dim->literal = literal;
+        dim->literal_len = p - literal;
+        dim->start = start;
+        dim->end = end;
+        dim->padding = padding;
+        url_len += dim->literal_len + (padding > 11 ? padding : 11);
+        literal = p = next;
+    }
+    t->tail = literal;
+    t->tail_len = strlen(literal);
+    url_len += t->tail_len;
+    
+    t->rows = 1;
+    for (int d = 0; d < t->count; d++) {
+        template_dim_t *dim = &t->dims[d];
+        bool last = d == t->count - 1;
+        // Brace ranges may start at 0; a * without -s/-e has no range
+        if (from_star[d] && dim->end <= 0 && config->discover && last) {
+            dim->end = INT_MAX - config->discover_gap - 1;  // found by discovery
+        }
+        if (from_star[d] && (dim->start <= 0 || dim->end <= 0)) {
+            fprintf(stderr, "Error: Placeholder %d of the template has no range (use -s/-e for *).\n", d + 1);
+            return false;
+        }
+        if (dim->start > dim->end) {
+            fprintf(stderr, "Error: Placeholder %d of the template starts after it ends.\n", d + 1);
+            return false;
+        }
+        if (!last) t->rows *= (long long)dim->end - dim->start + 1;
+        if (t->rows > INT_MAX) {
+            fprintf(stderr, "Error: Template expands to more than %d entries.\n", INT_MAX);
+            return false;
+        }
+    }
+    
+    const template_dim_t *inner = &t->dims[t->count - 1];
+    t->total = t->rows * ((long long)inner->end - inner->start + 1);
+    if (url_len >= MAX_URL_LENGTH) {
+        fprintf(stderr, "Error: Template URLs would exceed %d bytes.\n", MAX_URL_LENGTH);
+        return false;
+    }
+    return true;
+}
+
+// Parse text into t. A * takes -s/-e/-z from config; with --discover and
+// no -e, only the last placeholder may be open-ended.
+bool url_template_parse(url_template_t *t, const char *text, const config_t *config) {
+    memset(t, 0, sizeof(*t));
+    t->text = strdup(text);
+    if (!t->text) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return false;
+    }
+    if (url_template_split(t, config)) return true;
+    url_template_free(t);
+    memset(t, 0, sizeof(*t));
+    return false;
+}
+
+// Bytes a builder needs for the longest URL of the template
+size_t url_template_size(const url_template_t *t) {
+    size_t size = t->tail_len + 1;
+    for (int d = 0; d < t->count; d++) {
+        size += t->dims[d].literal_len + (t->dims[d].padding > 11 ? t->dims[d].padding : 11);
+    }
+    return size;
+}
+
+// Values of the placeholders but the last for row
+void url_template_row_values(const url_template_t *t, long long row, int *values) {
+    for (int d = t->count - 2; d >= 0; d--) {
+        long long size = (long long)t->dims[d].end - t->dims[d].start + 1;
+        values[d] = t->dims[d].start + (int)(row % size);
+        row /= size;
+    }
+}
+
+// Placeholder values of entry ordinal (1-based)
+void url_template_decode(const url_template_t *t, long long ordinal, int *values) {
+    long long index = ordinal - 1;
+    const template_dim_t *inner = &t->dims[t->count - 1];
+    long long row;
+    if (t->row_offsets) {
+        // Last row starting at or before index; empty rows share their successor's offset
+        long long lo = 0, hi = t->rows;
+        while (hi - lo > 1) {
+            long long mid = lo + (hi - lo) / 2;
+            if (t->row_offsets[mid] <= index) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        row = lo;
+        values[t->count - 1] = inner->start + (int)(index - t->row_offsets[row]);
+    } else {
+        long long width = (long long)inner->end - inner->start + 1;
+        row = index / width;
+        values[t->count - 1] = inner->start + (int)(index % width);
+    }
+    url_template_row_values(t, row, values);
+}
+
+void url_builder_init_template(url_builder_t *ub, char *buf, size_t capacity, const url_template_t *t) {
+    url_builder_init(ub, buf, capacity, "", t->tail, 0);
+    ub->tmpl = t;
+    ub->formatted = false;
+    memcpy(buf, t->dims[0].literal, t->dims[0].literal_len);
+    ub->offsets[0] = t->dims[0].literal_len;
+}
+
+// Render entry ordinal of a template, rewriting the buffer only from the
+// first placeholder whose value changed. Consecutive ordinals usually only
+// touch the last placeholder and the tail.
+const char *url_builder_format_template(url_builder_t *ub, int ordinal) {
+    const url_template_t *t = ub->tmpl;
+    int values[TEMPLATE_MAX_DIMS];
+    url_template_decode(t, ordinal, values);
+    
+    int d = 0;
+    if (ub->formatted) {
+        while (d < t->count && values[d] == ub->values[d]) d++;
+        if (d == t->count) return ub->buf;
+    }
+    
+    char *p = ub->buf + ub->offsets[d];
+    for (int j = d; j < t->count; j++) {
+        if (j > d) {
+            memcpy(p, t->dims[j].literal, t->dims[j].literal_len);
+            p += t->dims[j].literal_len;
+            ub->offsets[j] = p - ub->buf;
+        }
+        p += format_index(p, values[j], t->dims[j].padding);
+        ub->values[j] = values[j];
+    }
+    memcpy(p, t->tail, t->tail_len);
+    p[t->tail_len] = '\0';
+    ub->formatted = true;
+    return ub->buf;
+}
+
+// Size and set up a builder for either template form
+size_t run_url_size(const url_template_t *t, const char *prefix, const char *suffix, int padding) {
+    return t ? url_template_size(t) : url_builder_size(prefix, suffix, padding);
+}
+
+void run_url_builder_init(url_builder_t *ub, char *buf, size_t capacity, const url_template_t *t,
+                          const char *prefix, const char *suffix, int padding) {
+    if (t) {
+        url_builder_init_template(ub, buf, capacity, t);
+    } else {
+        url_builder_init(ub, buf, capacity, prefix, suffix, padding);
+    }
+}
+
+// Parallel generation for unverified runs: workers render fixed-size
+// chunks of the range into memory buffers, and the writer thread drains
+// them in chunk order through a small ring of slots
+typedef struct {
+    playlist_writer_t out;
+    bool ready;
+} gen_slot_t;
+
+typedef struct {
+    const config_t *config;
+    const entry_format_t *entry_format;
+    const char *link_prefix;
+    const char *link_suffix;
+    const url_template_t *tmpl;
+    int entry_base;
+    int num_chunks;
+    int next_chunk;         // next chunk a worker will claim
+    int next_write;         // next chunk the writer is waiting for
+    gen_slot_t *slots;
+    int num_slots;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_ready;
+    pthread_cond_t slot_free;
+} gen_pipeline_t;
+
+void *gen_pipeline_worker(void *arg) {
+    gen_pipeline_t *gp = (gen_pipeline_t *)arg;
+    const config_t *config = gp->config;
+    
+    // Without a URL buffer the worker still claims chunks, handing them back
+    // failed, so the writer never waits on a chunk nobody will render
+    size_t url_size = run_url_size(gp->tmpl, gp->link_prefix, gp->link_suffix, config->padding);
+    char *url_buf = malloc(url_size);
+    url_builder_t builder;
+    if (url_buf) {
+        run_url_builder_init(&builder, url_buf, url_size, gp->tmpl, gp->link_prefix, gp->link_suffix, config->padding);
+    }
+    
+    pthread_mutex_lock(&gp->lock);
+    while (gp->next_chunk < gp->num_chunks) {
+        int chunk = gp->next_chunk++;
+        while (chunk >= gp->next_write + gp->num_slots) {
+            pthread_cond_wait(&gp->slot_free, &gp->lock);
+        }
+        gen_slot_t *slot = &gp->slots[chunk % gp->num_slots];
+        pthread_mutex_unlock(&gp->lock);
+        
+        long long first = (long long)config->start + (long long)chunk * GEN_CHUNK_ENTRIES;
+        long long last = first + GEN_CHUNK_ENTRIES - 1;
+        if (last > config->end) last = config->end;
+        slot->out.len = 0;
+        if (!url_buf) slot->out.failed = true;
+        for (int i = (int)first; url_buf && i <= (int)last; i++) {
+            entry_format_write(&slot->out, gp->entry_format, url_builder_format(&builder, i),
+                               gp->entry_base + i - config->start + 1, i, NULL);
+        }
+        
+        pthread_mutex_lock(&gp->lock);
+        slot->ready = true;
+        pthread_cond_broadcast(&gp->slot_ready);
+    }
+    pthread_mutex_unlock(&gp->lock);
+    
+    free(url_buf);
+    return NULL;
+}
+
+// Render [config->start, config->end] on num_threads threads into out,
+// from tmpl when the template has several placeholders.
+// Returns false if the workers could not be started or ran out of memory.
+bool generate_parallel(playlist_writer_t *out, const entry_format_t *entry_format, const config_t *config,
+                       const char *link_prefix, const char *link_suffix, const url_template_t *tmpl,
+                       int entry_base, int num_threads, event_stream_t *events) {
+    gen_pipeline_t gp;
+    memset(&gp, 0, sizeof(gp));
+    gp.config = config;
+    gp.entry_format = entry_format;
+    gp.link_prefix = link_prefix;
+    gp.link_suffix = link_suffix;
+    gp.tmpl = tmpl;
+    gp.entry_base = entry_base;
+    gp.num_chunks = (int)(((long long)config->end - config->start + GEN_CHUNK_ENTRIES) / GEN_CHUNK_ENTRIES);
+    gp.num_slots = num_threads * 2;
+    pthread_mutex_init(&gp.lock, NULL);
+    pthread_cond_init(&gp.slot_ready, NULL);
+    pthread_cond_init(&gp.slot_free, NULL);
+    
+    bool ok = true;
+    gp.slots = calloc(gp.num_slots, sizeof(gen_slot_t));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    int started = 0;
+    if (!gp.slots || !threads) ok = false;
+    for (int i = 0; ok && i < gp.num_slots; i++) {
+        ok = playlist_writer_init_memory(&gp.slots[i].out);
+    }
+    for (int i = 0; ok && i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, gen_pipeline_worker, &gp) != 0) break;
+        started++;
+    }
+    if (started == 0) ok = false;
+    progress_meter_t progress;
+    progress_meter_init(&progress, 1);
+    
+    // Drain chunks in order; on failure keep draining so workers can finish
+    for (int chunk = 0; started > 0 && chunk < gp.num_chunks; chunk++) {
+        gen_slot_t *slot = &gp.slots[chunk % gp.num_slots];
+        pthread_mutex_lock(&gp.lock);
+        while (!slot->ready) {
+            pthread_cond_wait(&gp.slot_ready, &gp.lock);
+        }
+        pthread_mutex_unlock(&gp.lock);
+        
+        if (slot->out.failed) ok = false;
+        if (ok) writer_put(out, slot->out.buf, slot->out.len);
+        
+        pthread_mutex_lock(&gp.lock);
+        slot->ready = false;
+        gp.next_write++;
+        pthread_cond_broadcast(&gp.slot_free);
+        pthread_mutex_unlock(&gp.lock);
+        
+        if (progress_meter_due(&progress)) {
+            long long done = (long long)(chunk + 1) * GEN_CHUNK_ENTRIES;
+            long long total = (long long)config->end - config->start + 1;
+            if (done > total) done = total;
+            if (!config->verbose) {
+                printf("\rProgress: %lld/%lld", done, total);
+                fflush(stdout);
+            }
+            if (events) event_stream_progress(events, done, total, 0, 0);
+        }
+    }
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; gp.slots && i < gp.num_slots; i++) {
+        free(gp.slots[i].out.buf);
+    }
+    free(gp.slots);
+    free(threads);
+    pthread_mutex_destroy(&gp.lock);
+    pthread_cond_destroy(&gp.slot_ready);
+    pthread_cond_destroy(&gp.slot_free);
+    return ok;
+}
+
+// What an existing playlist already contains, for --incremental runs
+typedef struct {
+    bool exists;
+    int last_index;         // highest template index found in an entry URL
+    int entries;            // entries already in the file
+    int last_number;        // highest PLS FileN number
+    long footer_offset;     // XSPF: offset of the closing </trackList>, -1 if absent
+} playlist_scan_t;
+
+// Find the template index of an entry URL inside line, or -1 if none matches
+int parse_entry_index(const char *line, const char *prefix, const char *suffix) {
+    size_t prefix_len = strlen(prefix);
+    size_t suffix_len = strlen(suffix);
+    
+    for (const char *p = strstr(line, prefix); p; p = strstr(p + 1, prefix)) {
+        const char *digits = p + prefix_len;
+        const char *q = digits;
+        long value = 0;
+        while (isdigit((unsigned char)*q) && value <= INT_MAX) {
+            value = value * 10 + (*q - '0');
+            q++;
+        }
+        if (q > digits && value <= INT_MAX && strncmp(q, suffix, suffix_len) == 0) {
+            return (int)value;
+        }
+        if (!*p) break;
+    }
+    return -1;
+}
+
+// Spell text the way entries of format write it: entity-escaped inside
+// XSPF elements, with line breaks percent-encoded in the line formats
+char *entry_escape_text(playlist_format_t format, const char *text) {
+    size_t len = strlen(text);
+    char *escaped = malloc(len * 6 + 1);
+    if (!escaped) return NULL;
+    size_t n = format == FORMAT_XSPF ? entry_put_xml(escaped, text, len) : entry_put_line_url(escaped, text, len);
+    escaped[n] = '\0';
+    return escaped;
+}
+
+// Read an existing playlist and record which entries it already holds
+bool scan_playlist(const char *path, playlist_format_t format, const char *link_prefix,
+                   const char *link_suffix, playlist_scan_t *scan) {
+    memset(scan, 0, sizeof(*scan));
+    scan->footer_offset = -1;
+    
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    
+    // Entry URLs were escaped on the way out, so match the escaped template
+    char *prefix = entry_escape_text(format, link_prefix);
+    char *suffix = entry_escape_text(format, link_suffix);
+    if (!prefix || !suffix) {
+        free(prefix);
+        free(suffix);
+        fclose(file);
+        return false;
+    }
+    
+    char line[MAX_URL_LENGTH + 256];
+    long offset = 0;
+    while (fgets(line, sizeof(line), file)) {
+        long line_offset = offset;
+        offset = ftell(file);
+        
+        bool is_entry;
+        switch (format) {
+            case FORMAT_M3U:
+            case FORMAT_M3U8:
+                is_entry = line[0] != '#' && line[0] != '\n';
+                break;
+            case FORMAT_PLS:
+                is_entry = strncmp(line, "File", 4) == 0;
+                if (is_entry) {
+                    int number = atoi(line + 4);
+                    if (number > scan->last_number) scan->last_number = number;
+                }
+                break;
+            case FORMAT_XSPF:
+                is_entry = strstr(line, "<location>") != NULL;
+                if (strstr(line, "</trackList>")) scan->footer_offset = line_offset;
+                break;
+            default:
+                is_entry = line[0] != '\n';
+                break;
+        }
+        if (!is_entry) continue;
+        
+        scan->entries++;
+        int index = parse_entry_index(line, prefix, suffix);
+        if (index > scan->last_index) scan->last_index = index;
+    }
+    
+    scan->exists = offset > 0;
+    free(prefix);
+    free(suffix);
+    fclose(file);
+    return true;
+}
+
+// Rewrite the PLS NumberOfEntries line of path to count, in place when the
+// new value has the same width or the field was reserved at
+// PLS_COUNT_WIDTH digits, and through a temporary copy otherwise
+bool patch_pls_entry_count(const char *path, int count) {
+    static const char key[] = "NumberOfEntries=";
+    FILE *file = fopen(path, "r+");
+    if (!file) return false;
+    
+    char line[MAX_URL_LENGTH + 256];
+    long offset = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, key, sizeof(key) - 1) != 0) {
+            offset = ftell(file);
+            continue;
+        }
+        
+        char value[16];
+        int old_len = (int)strcspn(line + sizeof(key) - 1, "\r\n");
+        int value_len = old_len == PLS_COUNT_WIDTH ? (int)format_index(value, count, PLS_COUNT_WIDTH) :
+                        snprintf(value, sizeof(value), "%d", count);
+        if (value_len == old_len) {
+            fseek(file, offset + (long)sizeof(key) - 1, SEEK_SET);
+            fwrite(value, 1, value_len, file);
+            return fclose(file) == 0;
+        }
+        
+        // Width changed: copy the file with the new header line
+        size_t tmp_len = strlen(path) + 5;
+        char *tmp_path = malloc(tmp_len);
+        if (!tmp_path) break;
+        snprintf(tmp_path, tmp_len, "%s.tmp", path);
+        FILE *out = fopen(tmp_path, "w");
+        if (!out) {
+            free(tmp_path);
+            break;
+        }
+        
+        rewind(file);
+        char buffer[65536];
+        size_t remaining = (size_t)offset;
+        while (remaining > 0) {
+            size_t n = fread(buffer, 1, remaining < sizeof(buffer) ? remaining : sizeof(buffer), file);
+            if (n == 0) break;
+            fwrite(buffer, 1, n, out);
+            remaining -= n;
+        }
+        fgets(line, sizeof(line), file);
+        fprintf(out, "%s%s\n", key, value);
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            fwrite(buffer, 1, n, out);
+        }
+        
+        bool ok = fclose(out) == 0 && rename(tmp_path, path) == 0;
+        if (!ok) unlink(tmp_path);
+        free(tmp_path);
+        fclose(file);
+        return ok;
+    }
+    fclose(file);
+    return false;
+}
+
+// Probe the discovery window [index, index + gap] and report whether any
+// entry in it exists. The highest valid index seen is stored in *last_valid.
+bool discover_window(verify_engine_t *engine, const char *prefix, const char *suffix,
+                     int padding, int index, int *last_valid, int *probes) {
+    const config_t *config = engine->config;
+    int count = config->discover_gap + 1;
+    url_check_t *checks = calloc(count, sizeof(url_check_t));
+    if (!checks) return false;
+    
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        checks[n].url = generate_url(prefix, suffix, index + i, padding);
+        if (!checks[n].url) continue;
+        checks[n].index = index + i;
+        n++;
+    }
+    
+    verify_engine_run(engine, checks, n);
+    *probes += n;
+    
+    bool found = false;
+    for (int i = 0; i < n; i++) {
+        if (checks[i].is_valid) {
+            found = true;
+            if (checks[i].index > *last_valid) *last_valid = checks[i].index;
+        }
+        if (config->verbose) {
+            printf("Discover: %s [%s]\n", checks[i].url, checks[i].is_valid ? "OK" : "FAILED");
+        }
+        free(checks[i].url);
+    }
+    free(checks);
+    return found;
+}
+
+// Find the last index of the series at or after start, tolerating runs of
+// up to discover_gap missing entries. Gallops forward in powers of two
+// until a window comes back empty, then binary-searches the boundary.
+// Returns start - 1 if nothing exists.
+int discover_end(verify_engine_t *engine, const char *prefix, const char *suffix,
+                 int start, int upper, int padding) {
+    int last_valid = start - 1;
+    int probes = 0;
+    
+    if (!discover_window(engine, prefix, suffix, padding, start, &last_valid, &probes)) {
+        printf("Discovery: no entries found at %d (%d probes)\n", start, probes);
+        return last_valid;
+    }
+    
+    // Gallop: lo always has a non-empty window, hi an empty one (or is past upper)
+    long long lo = start;
+    long long hi = start;
+    long long step = 1;
+    for (;;) {
+        hi = start + step;
+        if (hi > upper) {
+            hi = (long long)upper + 1;
+            break;
+        }
+        if (!discover_window(engine, prefix, suffix, padding, (int)hi, &last_valid, &probes)) break;
+        lo = hi;
+        step *= 2;
+    }
+    
+    // Binary search between the last non-empty and first empty window
+    while (hi - lo > 1) {
+        long long mid = lo + (hi - lo) / 2;
+        if (discover_window(engine, prefix, suffix, padding, (int)mid, &last_valid, &probes)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    if (last_valid > upper) last_valid = upper;
+    printf("Discovery: last entry is %d (%d probes)\n", last_valid, probes);
+    return last_valid;
+}
+
+// --discover for a multi-placeholder template: find where the last
+// placeholder ends in every row instead of probing each combination, so a
+// season with 8 episodes costs a few probes rather than the whole range
+bool url_template_discover(url_template_t *t, verify_engine_t *engine) {
+    t->row_offsets = malloc((size_t)(t->rows + 1) * sizeof(long long));
+    char *prefix = malloc(url_template_size(t));
+    if (!t->row_offsets || !prefix) {
+        free(prefix);
+        return false;
+    }
+    
+    const template_dim_t *inner = &t->dims[t->count - 1];
+    int values[TEMPLATE_MAX_DIMS];
+    long long total = 0;
+    for (long long row = 0; row < t->rows; row++) {
+        // Everything up to the last placeholder is fixed within a row
+        url_template_row_values(t, row, values);
+        size_t len = 0;
+        for (int d = 0; d < t->count - 1; d++) {
+            memcpy(prefix + len, t->dims[d].literal, t->dims[d].literal_len);
+            len += t->dims[d].literal_len;
+            len += format_index(prefix + len, values[d], t->dims[d].padding);
+        }
+        memcpy(prefix + len, inner->literal, inner->literal_len);
+        prefix[len + inner->literal_len] = '\0';
+        
+        int last = discover_end(engine, prefix, t->tail, inner->start, inner->end, inner->padding);
+        t->row_offsets[row] = total;
+        total += last - inner->start + 1;
+    }
+    t->row_offsets[t->rows] = total;
+    t->total = total;
+    free(prefix);
+    return true;
+}
+
+// Output side of a playlist run, shared by the sequential and streaming loops
+typedef struct {
+    const config_t *config;
+    playlist_writer_t *writer;
+    const entry_format_t *entry_format;
+    int entry_base;
+    int total_entries;
+    int valid_count;
+    int invalid_count;
+    int written_count;
+    bool show_progress;           // off for --jobs streams, which show one line for the batch
+    int done;                     // entries consumed, including any replayed from the journal
+    progress_meter_t progress;
+    event_stream_t *events;       // --events stream, NULL if off
+    checkpoint_journal_t *journal; // --journal, NULL if off
+    int job;                      // job number reported in events
+} run_state_t;
+
+// Write or drop one finished entry and update progress
+void run_consume_entry(run_state_t *run, const url_check_t *check) {
+    const config_t *config = run->config;
+    int i = check->index;
+    
+    if (config->verify_urls) {
+        if (config->verbose) {
+            printf("Checking: %s [%s]\n", check->url,
+                   check->is_valid ? "OK" : check->skipped ? "SKIPPED" : "FAILED");
+        }
+    
+        if (check->is_valid) {
+            run->valid_count++;
+        } else {
+            run->invalid_count++;
+        }
+        if (run->events) event_stream_result(run->events, run->job, check);
+        if (run->journal) journal_append(run->journal, check);
+    }
+    
+    // Write to playlist if valid or verification not requested; a shard
+    // keeps every result for the merge
+    if (config->shards > 0) {
+        journal_record_t record;
+        journal_record_init(&record, check);
+        writer_put(run->writer, (const char *)&record, sizeof(record));
+        if (check->is_valid) run->written_count++;
+    } else if (check->is_valid || !config->verify_urls) {
+        entry_format_write(run->writer, run->entry_format, check->url, run->entry_base + run->written_count + 1, i,
+                           config->verify_urls ? &check->media : NULL);
+        run->written_count++;
+    }
+    
+    // Show progress
+    run->done++;
+    if (run->show_progress && progress_meter_due(&run->progress)) {
+        if (!config->verbose) {
+            printf("\rProgress: %d/%d", run->done, run->total_entries);
+            fflush(stdout);
+        }
+        if (run->events) {
+            event_stream_progress(run->events, run->done, run->total_entries, run->valid_count, run->invalid_count);
+        }
+    }
+}
+
+// One playlist to produce: a template, its range and an output file. The
+// command line describes a single job; --jobs reads one per manifest line.
+typedef struct {
+    config_t config;              // shared options with this job's template, range and output
+    char *line;                   // manifest line the template and output point into
+    int number;                   // position in the manifest, 0 for the command line
+    url_template_t tmpl;
+    url_template_t *multi;        // &tmpl for multi-placeholder templates, NULL for a single *
+    char *link_prefix;
+    char *link_suffix;
+    playlist_scan_t scan;
+    bool appending;
+    bool up_to_date;              // --incremental found nothing new to add
+    bool failed;
+    int fd;                       // output file while the job is open, -1 otherwise
+    playlist_writer_t writer;
+    entry_format_t entry_format;
+    long count_offset;            // reserved PLS NumberOfEntries digits in the file, -1 if none
+    bool count_trailer;           // the PLS count follows the entries instead
+    run_state_t run;
+    int generated;                // entries handed to the verify stream
+    int consumed;
+    int misses;                   // consecutive invalid entries consumed so far
+    bool stopped;                 // --stop-after-misses ended the series early
+    int stop_index;               // index of the miss that ended it
+    event_stream_t *events;       // --events stream shared by every job, NULL if off
+    checkpoint_journal_t journal;
+    int sweep_start;              // --shard: the range before it was narrowed to this block
+    int sweep_end;
+    bool quiet;                   // a --serve request or a merge: no terminal output
+} playlist_job_t;
+
+int job_total(const playlist_job_t *job) {
+    return job->config.end - job->config.start + 1;
+}
+
+// Entries of the job that pass through the verify stream
+int job_stream_total(const playlist_job_t *job) {
+    return job->stopped ? job->generated : job_total(job);
+}
+
+bool job_runnable(const playlist_job_t *job) {
+    return !job->failed && !job->up_to_date;
+}
+
+// Resolve a job's template and range before anything is written: split or
+// parse the template, pick up an existing playlist for --incremental and
+// run --discover. engine is NULL when nothing is probed.
+bool job_prepare(playlist_job_t *job, verify_engine_t *engine) {
+    config_t *config = &job->config;
+    
+    // A single * keeps the prefix/suffix fast path; several placeholders
+    // are expanded through a url_template_t numbered 1..total
+    if (template_is_multi(config->link_template)) {
+        if (config->incremental) {
+            fprintf(stderr, "Error: --incremental needs a template with a single *.\n");
+            return false;
+        }
+        // Shard headers record one ordinal range, not every placeholder's
+        if (config->shards > 0) {
+            fprintf(stderr, "Error: --shard needs a template with a single *.\n");
+            return false;
+        }
+        job->multi = &job->tmpl;
+        if (!url_template_parse(&job->tmpl, config->link_template, config)) return false;
+        job->link_prefix = strdup("");
+        job->link_suffix = strdup("");
+    } else {
+        char *asterisk = strchr(config->link_template, '*');
+        if (!asterisk) {
+            fprintf(stderr, "Error: No wildcard (*) found in template.\n");
+            return false;
+        }
+        job->link_prefix = strndup(config->link_template, asterisk - config->link_template);
+        job->link_suffix = strdup(asterisk + 1);
+    }
+    
+    if (!job->link_prefix || !job->link_suffix) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return false;
+    }
+    
+    // Continue after the last entry of an existing playlist
+    if (config->incremental) {
+        scan_playlist(config->playlist_file, config->format, job->link_prefix, job->link_suffix, &job->scan);
+        job->appending = job->scan.exists;
+        if (job->appending && job->scan.last_index >= config->start) {
+            printf("Existing playlist has %d entries up to index %d\n", job->scan.entries, job->scan.last_index);
+            config->start = job->scan.last_index + 1;
+        }
+    }
+    
+    // Find the real end of the series, using -e as an upper bound if given
+    if (job->multi) {
+        if (config->discover && !url_template_discover(job->multi, engine)) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            return false;
+        }
+        if (job->multi->total == 0) {
+            fprintf(stderr, "Error: No entries found for the template.\n");
+            return false;
+        }
+        if (job->multi->total > INT_MAX) {
+            fprintf(stderr, "Error: Template expands to more than %d entries.\n", INT_MAX);
+            return false;
+        }
+        // From here on entries are addressed by their ordinal in the template
+        config->start = 1;
+        config->end = (int)job->multi->total;
+    } else if (config->discover && (config->end == 0 || config->start <= config->end)) {
+        int upper = config->end > 0 ? config->end : INT_MAX - config->discover_gap - 1;
+        config->end = discover_end(engine, job->link_prefix, job->link_suffix, config->start, upper, config->padding);
+        if (config->end < config->start && !job->appending) {
+            fprintf(stderr, "Error: No entries found starting at %d.\n", config->start);
+            return false;
+        }
+    }
+    
+    if (job->appending && config->start > config->end) {
+        printf("Playlist file '%s' is already up to date.\n", config->playlist_file);
+        job->up_to_date = true;
+        return true;
+    }
+    
+    // Keep only this node's block of the sweep
+    if (config->shards > 0) {
+        job->sweep_start = config->start;
+        job->sweep_end = config->end;
+        shard_partition(config, config->shard, config->shards);
+    }
+    
+    // Pick up where an interrupted run left off: its entries are replayed
+    // from the journal and probing continues after the last of them
+    if (config->journal) {
+        if (!journal_init(&job->journal, config)) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            return false;
+        }
+        if (config->resume && !journal_load(&job->journal)) return false;
+    
+        // A narrower -e leaves the records past it to be dropped
+        while (job->journal.replay_count > 0 &&
+               job->journal.replay[job->journal.replay_count - 1].index > config->end) {
+            job->journal.replay_count--;
+        }
+        int replayed = job->journal.replay_count;
+        if (replayed > 0) {
+            int last = job->journal.replay[replayed - 1].index;
+            while (job->misses < replayed && !job->journal.replay[replayed - 1 - job->misses].is_valid) {
+                job->misses++;
+            }
+            printf("Resuming after index %d with %d entries from '%s'\n", last, replayed, job->journal.path);
+            config->start = last + 1;
+            if (config->stop_after_misses > 0 && job->misses >= config->stop_after_misses) {
+                job->stopped = true;
+                job->stop_index = last;
+            }
+            if (job->stopped || config->end < config->start) config->end = config->start - 1;
+        }
+    }
+    
+    // Make sure the output can be opened now, so a bad path fails before
+    // any probing; the file is opened for real when the job starts
+    if (config->output_fd >= 0) return true;
+    int fd = open(config->playlist_file, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Error opening output file");
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+// Write the entries an interrupted run already verified, as they are in
+// its journal, so the playlist comes out as if the run had never stopped
+bool job_replay(playlist_job_t *job) {
+    checkpoint_journal_t *journal = &job->journal;
+    run_state_t *run = &job->run;
+    if (journal->replay_count == 0) return true;
+    
+    size_t url_size = run_url_size(job->multi, job->link_prefix, job->link_suffix, job->config.padding);
+    char *url_buf = malloc(url_size);
+    if (!url_buf) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return false;
+    }
+    url_builder_t builder;
+    run_url_builder_init(&builder, url_buf, url_size, job->multi, job->link_prefix, job->link_suffix,
+                         job->config.padding);
+    
+    for (int r = 0; r < journal->replay_count; r++) {
+        const journal_record_t *record = &journal->replay[r];
+        run->done++;
+        if (!record->is_valid) {
+            run->invalid_count++;
+        } else {
+            run->valid_count++;
+        }
+        
+        // A shard keeps its records as they are
+        if (job->config.shards > 0) {
+            writer_put(run->writer, (const char *)record, sizeof(*record));
+            if (record->is_valid) run->written_count++;
+            continue;
+        }
+        if (!record->is_valid) continue;
+        
+        media_info_t media;
+        media_info_reset(&media);
+        media.duration_ms = record->duration_ms;
+        memcpy(media.title, record->title, sizeof(media.title));
+        memcpy(media.artist, record->artist, sizeof(media.artist));
+        media.title[sizeof(media.title) - 1] = '\0';
+        media.artist[sizeof(media.artist) - 1] = '\0';
+        entry_format_write(run->writer, run->entry_format, url_builder_format(&builder, record->index),
+                           run->entry_base + run->written_count + 1, record->index, &media);
+        run->written_count++;
+    }
+    free(url_buf);
+    
+    // Only the record count is still needed, to keep the journal's length
+    free(journal->replay);
+    journal->replay = NULL;
+    return true;
+}
+
+// Open a prepared job's output and write the playlist header
+bool job_open(playlist_job_t *job) {
+    config_t *config = &job->config;
+    
+    if (!entry_format_compile(&job->entry_format, config->format, config->link_template,
+                              config->prefix_text, config->suffix_text, config->verify_urls)) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        job->failed = true;
+        return false;
+    }
+    
+    // Open output file, dropping the XSPF footer when appending so it can be rewritten
+    int fd = config->output_fd;
+    if (fd < 0) fd = open(config->playlist_file, job->appending ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+    if (fd >= 0 && job->appending) {
+        if ((job->scan.footer_offset >= 0 && ftruncate(fd, job->scan.footer_offset) != 0) ||
+            lseek(fd, 0, SEEK_END) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0 || !playlist_writer_init(&job->writer, fd)) {
+        perror("Error opening output file");
+        if (fd >= 0 && fd != config->output_fd) close(fd);
+        job->failed = true;
+        return false;
+    }
+    job->fd = fd;
+    if (!playlist_writer_compress(&job->writer, config->compress)) {
+        fprintf(stderr, "Error: Failed to start compression.\n");
+        job->failed = true;
+        return false;
+    }
+    
+    // Verification drops entries, so their PLS count is only known at the
+    // end: it is stored over reserved digits in a file, or follows the
+    // entries in a stream, which cannot be written back to
+    int total_entries = job_total(job) + job->journal.replay_count;
+    job->count_offset = -1;
+    job->count_trailer = false;
+    if (!job->appending) {
+        pls_count_t count = PLS_COUNT_KNOWN;
+        if (config->verify_urls) {
+            job->count_trailer = config->output_fd >= 0 || config->compress != COMPRESS_NONE;
+            count = job->count_trailer ? PLS_COUNT_TRAILER : PLS_COUNT_RESERVED;
+        }
+        if (config->shards > 0) {
+            write_shard_header(&job->writer, config, job->sweep_start, job->sweep_end);
+        } else {
+            job->count_offset = write_playlist_header(&job->writer, config->format, total_entries, count);
+        }
+    }
+    
+    // PLS numbering continues after the entries already in the file
+    job->run = (run_state_t){
+        .config = config,
+        .writer = &job->writer,
+        .entry_format = &job->entry_format,
+        .entry_base = job->appending ? job->scan.last_number : 0,
+        .total_entries = total_entries,
+        .show_progress = !job->quiet && (job->number == 0 || !config->verify_urls),
+        .events = job->events,
+        .job = job->number
+    };
+    progress_meter_init(&job->run.progress, config->verify_urls ? 1 : PROGRESS_STRIDE);
+    
+    if (config->journal) {
+        if (!journal_open(&job->journal)) {
+            fprintf(stderr, "Error: Cannot write journal '%s'.\n", job->journal.path);
+            job->failed = true;
+            return false;
+        }
+        job->run.journal = &job->journal;
+        if (!job_replay(job)) {
+            job->failed = true;
+            return false;
+        }
+    }
+    
+    if (job->quiet) {
+        // Requests are logged by the server, merges by merge_main
+    } else if (job->number == 0) {
+        printf("Generating playlist with %d entries...\n", total_entries);
+    } else {
+        printf("\rGenerating '%s' with %d entries...\n", config->playlist_file, total_entries);
+    }
+    return true;
+}
+
+// Render every entry of an open job without probing
+bool job_generate(playlist_job_t *job) {
+    config_t *config = &job->config;
+    run_state_t *run = &job->run;
+    
+    if (config->gen_threads > 1) {
+        // Without verification every entry is written, so the range can be rendered in parallel
+        if (!generate_parallel(&job->writer, &job->entry_format, config, job->link_prefix, job->link_suffix,
+                               job->multi, run->entry_base, config->gen_threads, job->events)) {
+            fprintf(stderr, "Error: Parallel generation failed.\n");
+            return false;
+        }
+        run->written_count = run->total_entries;
+        return true;
+    }
+    
+    size_t url_size = run_url_size(job->multi, job->link_prefix, job->link_suffix, config->padding);
+    char *url_buf = malloc(url_size);
+    if (!url_buf) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return false;
+    }
+    url_builder_t builder;
+    run_url_builder_init(&builder, url_buf, url_size, job->multi, job->link_prefix, job->link_suffix, config->padding);
+    
+    url_check_t check = {.is_valid = true};
+    for (int i = config->start; i <= config->end; i++) {
+        check.url = (char *)url_builder_format(&builder, i);
+        check.index = i;
+        run_consume_entry(run, &check);
+    }
+    free(url_buf);
+    return true;
+}
+
+// Finish an open job: write the footer, fill in a reserved PLS count or
+// fix up the count of an appended playlist, and close the file. Manifest
+// jobs report themselves here; the command-line job is reported by main.
+bool job_close(playlist_job_t *job) {
+    config_t *config = &job->config;
+    run_state_t *run = &job->run;
+    
+    if (job->stopped) {
+        printf("\rStopped at index %d after %d consecutive misses\n", job->stop_index, config->stop_after_misses);
+    } else if (run->show_progress && !config->verbose) {
+        printf("\rProgress: %d/%d\n", run->total_entries, run->total_entries);
+    }
+    if (run->show_progress && job->events) {
+        int done = job->stopped ? job_stream_total(job) : run->total_entries;
+        event_stream_progress(job->events, done, run->total_entries, run->valid_count, run->invalid_count);
+    }
+    
+    // Write playlist footer
+    if (config->shards == 0) {
+        write_playlist_footer(&job->writer, config->format, job->count_trailer ? run->written_count : -1);
+    }
+    
+    bool write_ok = playlist_writer_close(&job->writer);
+    if (write_ok && job->count_offset >= 0) {
+        char digits[PLS_COUNT_WIDTH];
+        format_index(digits, run->written_count, PLS_COUNT_WIDTH);
+        if (pwrite(job->fd, digits, PLS_COUNT_WIDTH, job->count_offset) != PLS_COUNT_WIDTH) write_ok = false;
+    }
+    // Mark a shard that --stop-after-misses ended before its block did
+    if (write_ok && config->shards > 0 && job->stopped) {
+        uint32_t flags = SHARD_STOPPED;
+        if (pwrite(job->fd, &flags, sizeof(flags), offsetof(shard_header_t, flags)) != sizeof(flags)) {
+            write_ok = false;
+        }
+    }
+    if (close(job->fd) != 0) write_ok = false;
+    job->fd = -1;
+    if (config->journal) journal_close(&job->journal, write_ok);
+    if (!write_ok) {
+        perror("Error writing output file");
+        job->failed = true;
+        return false;
+    }
+    
+    if (job->appending && config->format == FORMAT_PLS &&
+        !patch_pls_entry_count(config->playlist_file, job->scan.entries + run->written_count)) {
+        fprintf(stderr, "Warning: Failed to update NumberOfEntries in '%s'.\n", config->playlist_file);
+    }
+    
+    if (job->number > 0 && !job->quiet) {
+        if (config->verify_urls) {
+            printf("\rPlaylist file '%s' created: %d valid, %d invalid URLs\n",
+                   config->playlist_file, run->valid_count, run->invalid_count);
+        } else {
+            printf("Playlist file '%s' created successfully.\n", config->playlist_file);
+        }
+    }
+    return true;
+}
+
+void job_free(playlist_job_t *job) {
+    if (job->fd >= 0) {
+        playlist_writer_close(&job->writer);
+        close(job->fd);
+    }
+    entry_format_free(&job->entry_format);
+    if (job->config.journal) journal_free(&job->journal);
+    free(job->link_prefix);
+    free(job->link_suffix);
+    if (job->multi) url_template_free(job->multi);
+    free(job->line);
+}
+
+void jobs_free(playlist_job_t *jobs, int num_jobs) {
+    for (int j = 0; j < num_jobs; j++) {
+        job_free(&jobs[j]);
+    }
+    free(jobs);
+}
+
+// Split line at tabs into at most max_fields fields; from first_optional
+// on, empty and "-" fields become NULL. Returns the number of fields.
+int split_tab_fields(char *line, char *fields[], int max_fields, int first_optional) {
+    int num_fields = 0;
+    for (char *p = line; p && num_fields < max_fields; ) {
+        fields[num_fields++] = p;
+        p = strchr(p, '\t');
+        if (p) *p++ = '\0';
+    }
+    for (int f = first_optional; f < num_fields; f++) {
+        if (fields[f][0] == '\0' || strcmp(fields[f], "-") == 0) fields[f] = NULL;
+    }
+    return num_fields;
+}
+
+// Apply the optional start, end, format and padding fields of a manifest
+// line or --serve request to config; NULL fields keep the defaults.
+// Returns what is wrong with the resulting range, or NULL.
+const char *apply_range_fields(config_t *config, char *const fields[4]) {
+    if (fields[0]) config->start = atoi(fields[0]);
+    if (fields[1]) config->end = atoi(fields[1]);
+    if (fields[2]) config->format = parse_format(fields[2]);
+    if (fields[3]) config->padding = atoi(fields[3]);
+    
+    bool needs_range = strchr(config->link_template, '*') != NULL;
+    if (needs_range && (config->start <= 0 || (config->end <= 0 && !config->discover))) {
+        return "Missing start or end for the template";
+    }
+    if (config->end > 0 && config->start > config->end) {
+        return "Start value cannot be greater than end value";
+    }
+    return NULL;
+}
+
+// Read a --jobs manifest with one job per line and tab-separated fields:
+//   template  output  [start  [end  [format  [padding]]]]
+// Missing, empty or "-" optional fields take the command-line value.
+// Blank lines and lines starting with # are skipped.
+bool load_jobs(const char *path, const config_t *defaults, playlist_job_t **jobs_out, int *count_out) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open job manifest '%s'.\n", path);
+        return false;
+    }
+    
+    playlist_job_t *jobs = NULL;
+    int count = 0;
+    int capacity = 0;
+    bool ok = true;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+    while (getline(&line, &line_capacity, file) >= 0) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+    
+        if (count == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 16;
+            playlist_job_t *grown = realloc(jobs, (size_t)new_capacity * sizeof(playlist_job_t));
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed.\n");
+                ok = false;
+                break;
+            }
+            jobs = grown;
+            capacity = new_capacity;
+        }
+        playlist_job_t *job = &jobs[count++];
+        memset(job, 0, sizeof(*job));
+        job->config = *defaults;
+        job->number = count;
+        job->fd = -1;
+        job->journal.fd = -1;
+        job->line = strdup(line);
+        if (!job->line) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            ok = false;
+            break;
+        }
+    
+        char *fields[6] = {NULL};
+        int num_fields = split_tab_fields(job->line, fields, 6, 2);
+        if (num_fields < 2 || fields[0][0] == '\0' || fields[1][0] == '\0') {
+            fprintf(stderr, "Error: %s:%d: Expected a template and an output file.\n", path, line_number);
+            ok = false;
+            break;
+        }
+        config_t *config = &job->config;
+        config->link_template = fields[0];
+        config->playlist_file = fields[1];
+        if (strcmp(config->playlist_file, "-") == 0) {
+            fprintf(stderr, "Error: %s:%d: Only the command-line playlist can be written to stdout.\n",
+                    path, line_number);
+            ok = false;
+            break;
+        }
+        const char *problem = apply_range_fields(config, &fields[2]);
+        if (problem) {
+            fprintf(stderr, "Error: %s:%d: %s.\n", path, line_number, problem);
+            ok = false;
+            break;
+        }
+    }
+    free(line);
+    fclose(file);
+    
+    if (ok && count == 0) {
+        fprintf(stderr, "Error: Job manifest '%s' has no jobs.\n", path);
+        ok = false;
+    }
+    if (!ok) {
+        jobs_free(jobs, count);
+        return false;
+    }
+    *jobs_out = jobs;
+    *count_out = count;
+    return true;
+}
+
+// Verify stream over every runnable job. Up to JOBS_MAX_ACTIVE jobs take
+// turns of JOB_QUANTUM entries, so one engine keeps probing all of them
+// instead of draining a series before starting the next; a job opens when
+// it joins the rotation and closes once its last entry is consumed.
+typedef struct {
+    playlist_job_t *jobs;
+    int num_jobs;
+    int next_job;                 // next job to join the rotation
+    int active[JOBS_MAX_ACTIVE];  // jobs still handing out entries
+    int num_active;
+    int turn;                     // index into active[] of the job generating now
+    int quantum_left;
+    url_builder_t *builders;      // one per reorder window slot
+    int *slot_jobs;               // job each slot's builder is set up for, -1 if none
+    url_check_t **slot_checks;    // window slot each builder's entry was generated into
+    char *url_slab;
+    size_t url_size;
+    int window_size;
+    long long consumed;
+    long long total;
+    int valid_count;              // over every job, for --events progress
+    int invalid_count;
+    bool show_progress;
+    progress_meter_t progress;
+    event_stream_t *events;
+} job_scheduler_t;
+
+// Put the next runnable job into active[slot]. A job whose output fails to
+// open stays in the stream; its entries are probed but dropped.
+bool job_scheduler_admit(job_scheduler_t *s, int slot) {
+    while (s->next_job < s->num_jobs) {
+        playlist_job_t *job = &s->jobs[s->next_job++];
+        if (!job_runnable(job) || job_total(job) == 0) continue;
+        if (job->fd < 0) job_open(job);
+        s->active[slot] = (int)(job - s->jobs);
+        return true;
+    }
+    return false;
+}
+
+void jobs_generate(void *user, long long seq, url_check_t *check) {
+    job_scheduler_t *s = (job_scheduler_t *)user;
+    while (s->num_active < JOBS_MAX_ACTIVE && job_scheduler_admit(s, s->num_active)) {
+        s->num_active++;
+    }
+    if (s->quantum_left == 0) {
+        s->turn = (s->turn + 1) % s->num_active;
+        s->quantum_left = JOB_QUANTUM;
+    }
+    
+    int j = s->active[s->turn];
+    playlist_job_t *job = &s->jobs[j];
+    int i = job->config.start + job->generated++;
+    s->quantum_left--;
+    
+    // Slots are reused only after their entry is consumed, so the builder
+    // and the job recorded for a slot stay valid until then
+    int slot = (int)(seq % s->window_size);
+    if (s->slot_jobs[slot] != j) {
+        run_url_builder_init(&s->builders[slot], s->url_slab + (size_t)slot * s->url_size, s->url_size,
+                             job->multi, job->link_prefix, job->link_suffix, job->config.padding);
+        s->slot_jobs[slot] = j;
+    }
+    check->url = (char *)url_builder_format(&s->builders[slot], i);
+    check->index = i;
+    check->is_valid = true;
+    s->slot_checks[slot] = check;
+    
+    // A job that has handed out every entry leaves the rotation
+    if (job->generated == job_total(job)) {
+        if (job_scheduler_admit(s, s->turn)) {
+            s->quantum_left = JOB_QUANTUM;
+        } else {
+            memmove(&s->active[s->turn], &s->active[s->turn + 1],
+                    (size_t)(s->num_active - s->turn - 1) * sizeof(int));
+            s->num_active--;
+            s->turn--;
+            s->quantum_left = 0;
+        }
+    }
+}
+
+// End job j after its entry at index: take it out of the rotation, shrink
+// the run by the entries it has not handed out yet, and cancel the ones
+// still queued or in flight. Those are consumed as usual but dropped.
+void job_scheduler_stop(job_scheduler_t *s, int j, int index) {
+    playlist_job_t *job = &s->jobs[j];
+    job->stopped = true;
+    job->stop_index = index;
+    s->total -= job_total(job) - job->generated;
+    
+    for (int a = 0; a < s->num_active; a++) {
+        if (s->active[a] != j) continue;
+        memmove(&s->active[a], &s->active[a + 1], (size_t)(s->num_active - a - 1) * sizeof(int));
+        s->num_active--;
+        if (a <= s->turn) {
+            if (a == s->turn) s->quantum_left = 0;
+            s->turn--;
+        }
+        break;
+    }
+    
+    for (int slot = 0; slot < s->window_size; slot++) {
+        if (s->slot_jobs[slot] == j && s->slot_checks[slot]->index > index) {
+            __atomic_store_n(&s->slot_checks[slot]->cancelled, true, __ATOMIC_RELAXED);
+        }
+    }
 }
 
-// Check if URL is accessible
-bool check_url(const char *url) {
-    CURL *curl = curl_easy_init();
-    if (!curl) return false;
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, DEFAULT_TIMEOUT);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+void jobs_consume(void *user, long long seq, url_check_t *check) {
+    job_scheduler_t *s = (job_scheduler_t *)user;
+    int j = s->slot_jobs[seq % s->window_size];
+    playlist_job_t *job = &s->jobs[j];
+    int max_misses = job->config.stop_after_misses;
     
-    CURLcode res = curl_easy_perform(curl);
-    long response_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-    curl_easy_cleanup(curl);
+    if (!job->stopped) {
+        if (job->fd < 0) {
+            // The output never opened; stop probing for it
+            job_scheduler_stop(s, j, check->index);
+        } else {
+            run_consume_entry(&job->run, check);
+            if (check->is_valid) {
+                s->valid_count++;
+            } else {
+                s->invalid_count++;
+            }
+            job->misses = check->is_valid ? 0 : job->misses + 1;
+            if (max_misses > 0 && job->misses >= max_misses) job_scheduler_stop(s, j, check->index);
+        }
+    }
+    if (++job->consumed == job_stream_total(job) && job->fd >= 0) job_close(job);
     
-    return (res == CURLE_OK && response_code >= 200 && response_code < 400);
+    s->consumed++;
+    if (s->show_progress && progress_meter_due(&s->progress)) {
+        if (!job->config.verbose) {
+            printf("\rProgress: %lld/%lld", s->consumed, s->total);
+            fflush(stdout);
+        }
+        if (s->events) event_stream_progress(s->events, s->consumed, s->total, s->valid_count, s->invalid_count);
+    }
 }
 
-// Thread function for parallel URL checking
-void *check_url_thread(void *arg) {
-    url_check_t *check = (url_check_t *)arg;
-    check->is_valid = check_url(check->url);
-    return NULL;
+// Push finished entries out before blocking, so the playlists can be tailed
+void jobs_idle(void *user) {
+    job_scheduler_t *s = (job_scheduler_t *)user;
+    for (int j = 0; j < s->next_job; j++) {
+        if (s->jobs[j].fd >= 0) playlist_writer_flush(&s->jobs[j].writer);
+        if (s->jobs[j].journal.fd >= 0) playlist_writer_flush(&s->jobs[j].journal.out);
+    }
 }
 
-void print_usage(const char *prog_name) {
-    fprintf(stderr, "Enhanced Playlist Generator v2.0\n");
-    fprintf(stderr, "Usage: %s [OPTIONS]\n\n", prog_name);
-    fprintf(stderr, "Required options:\n");
-    fprintf(stderr, "  -l <template>    URL template with wildcard (*)\n");
-    fprintf(stderr, "  -s <start>       Starting number\n");
-    fprintf(stderr, "  -e <end>         Ending number\n");
-    fprintf(stderr, "  -p <file>        Output playlist file\n\n");
-    fprintf(stderr, "Optional options:\n");
-    fprintf(stderr, "  -f <format>      Playlist format: plain|m3u|m3u8|pls|xspf (default: plain)\n");
-    fprintf(stderr, "  -z <padding>     Zero-pad numbers (e.g., -z 3 for 001, 002, ...)\n");
-    fprintf(stderr, "  -v               Verify URLs (check if accessible)\n");
-    fprintf(stderr, "  -V               Verbose output\n");
-    fprintf(stderr, "  -t <threads>     Number of threads for URL verification (default: 4)\n");
-    fprintf(stderr, "  -P <prefix>      Add prefix text to each entry\n");
-    fprintf(stderr, "  -S <suffix>      Add suffix text to each entry\n\n");
-    fprintf(stderr, "Examples:\n");
-    fprintf(stderr, "  %s -l \"http://example.com/episode_*.mp3\" -s 1 -e 10 -p playlist.m3u -f m3u\n", prog_name);
-    fprintf(stderr, "  %s -l \"http://cdn.example.com/video_*.mp4\" -s 1 -e 100 -p videos.m3u8 -f m3u8 -z 3 -v\n", prog_name);
+long long jobs_count(void *user) {
+    return ((job_scheduler_t *)user)->total;
 }
 
-playlist_format_t parse_format(const char *format_str) {
-    if (!format_str) return FORMAT_PLAIN;
+// Finish the jobs whose journal left nothing to probe
+void jobs_replay_complete(playlist_job_t *jobs, int num_jobs) {
+    for (int j = 0; j < num_jobs; j++) {
+        playlist_job_t *job = &jobs[j];
+        if (!job_runnable(job) || job_total(job) > 0) continue;
+        if (job->fd < 0 && !job_open(job)) continue;
+        job_close(job);
+    }
+}
+
+// Verify and write every runnable job through one engine, sharing its
+// worker pool or event loop, connection pool and cache across jobs
+bool jobs_verify(verify_engine_t *engine, playlist_job_t *jobs, int num_jobs, bool show_progress) {
+    job_scheduler_t s = {
+        .jobs = jobs,
+        .num_jobs = num_jobs,
+        .turn = -1,
+        .show_progress = show_progress,
+        .events = jobs[0].events
+    };
+    progress_meter_init(&s.progress, 1);
+    for (int j = 0; j < num_jobs; j++) {
+        if (!job_runnable(&jobs[j])) continue;
+        s.total += job_total(&jobs[j]);
+        size_t url_size = run_url_size(jobs[j].multi, jobs[j].link_prefix, jobs[j].link_suffix,
+                                       jobs[j].config.padding);
+        if (url_size > s.url_size) s.url_size = url_size;
+    }
+    if (s.total == 0) return true;
     
-    if (strcasecmp(format_str, "m3u") == 0) return FORMAT_M3U;
-    if (strcasecmp(format_str, "m3u8") == 0) return FORMAT_M3U8;
-    if (strcasecmp(format_str, "pls") == 0) return FORMAT_PLS;
-    if (strcasecmp(format_str, "xspf") == 0) return FORMAT_XSPF;
+    // Probe through a bounded reorder window that is written out in index order
+    s.window_size = verify_engine_concurrency(engine) * VERIFY_WINDOW_PER_SLOT;
+    if (s.window_size > s.total) s.window_size = (int)s.total;
     
-    return FORMAT_PLAIN;
+    s.builders = calloc(s.window_size, sizeof(url_builder_t));
+    s.slot_jobs = malloc((size_t)s.window_size * sizeof(int));
+    s.slot_checks = calloc(s.window_size, sizeof(url_check_t *));
+    s.url_slab = malloc((size_t)s.window_size * s.url_size);
+    bool ok = s.builders && s.slot_jobs && s.slot_checks && s.url_slab;
+    if (ok) {
+        for (int slot = 0; slot < s.window_size; slot++) {
+            s.slot_jobs[slot] = -1;
+        }
+        verify_stream_t ops = {jobs_generate, jobs_consume, jobs_idle, &s, jobs_count};
+        ok = verify_engine_stream(engine, s.total, s.window_size, &ops);
+    }
+    free(s.builders);
+    free(s.slot_jobs);
+    free(s.slot_checks);
+    free(s.url_slab);
+    
+    if (ok && show_progress && !jobs[0].config.verbose) {
+        printf("\rProgress: %lld/%lld\n", s.total, s.total);
+    }
+    if (ok && show_progress && s.events) {
+        event_stream_progress(s.events, s.consumed, s.total, s.valid_count, s.invalid_count);
+    }
+    return ok;
 }
 
-void write_playlist_header(FILE *file, playlist_format_t format, int total_entries) {
-    switch (format) {
-        case FORMAT_M3U:
-        case FORMAT_M3U8:
-            fprintf(file, "#EXTM3U\n");
-            break;
-        case FORMAT_PLS:
-            fprintf(file, "[playlist]\n");
-            fprintf(file, "NumberOfEntries=%d\n", total_entries);
-            fprintf(file, "Version=2\n\n");
-            break;
-        case FORMAT_XSPF:
-            fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-            fprintf(file, "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n");
-            fprintf(file, "  <trackList>\n");
-            break;
-        default:
-            break;
-    }
+void print_merge_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s merge -p <file> [-f <format>] [-P <prefix>] [-S <suffix>] <shard>...\n\n", prog_name);
+    fprintf(stderr, "Stitch the --shard K/N outputs of one sweep into a single playlist.\n");
+    fprintf(stderr, "Every shard from 1 to N must be given, in any order.\n");
 }
 
-void write_playlist_entry(FILE *file, playlist_format_t format, const char *url, 
-                         int index, const char *title, const char *prefix, const char *suffix) {
-    char full_url[MAX_URL_LENGTH];
-    snprintf(full_url, sizeof(full_url), "%s%s%s", 
-             prefix ? prefix : "", url, suffix ? suffix : "");
+// "lkvad merge": render every shard's valid entries, in shard order, into
+// one playlist numbered as if the sweep had run on a single machine
+int merge_main(int argc, char *argv[], const char *prog_name) {
+    config_t config;
+    memset(&config, 0, sizeof(config));
+    config.output_fd = -1;
+    config.events_fd = -1;
+    config.verify_urls = true;
+    char *format_str = NULL;
     
-    switch (format) {
-        case FORMAT_M3U:
-        case FORMAT_M3U8:
-            fprintf(file, "#EXTINF:-1,%s\n", title ? title : url);
-            fprintf(file, "%s\n", full_url);
-            break;
-        case FORMAT_PLS:
-            fprintf(file, "File%d=%s\n", index, full_url);
-            fprintf(file, "Title%d=%s\n", index, title ? title : url);
-            fprintf(file, "Length%d=-1\n\n", index);
+    int c;
+    while ((c = getopt(argc, argv, "p:f:P:S:h")) != -1) {
+        switch (c) {
+            case 'p':
+                config.playlist_file = optarg;
+                break;
+            case 'f':
+                format_str = optarg;
+                break;
+            case 'P':
+                config.prefix_text = optarg;
+                break;
+            case 'S':
+                config.suffix_text = optarg;
+                break;
+            case 'h':
+                print_merge_usage(prog_name);
+                return 0;
+            default:
+                print_merge_usage(prog_name);
+                return 1;
+        }
+    }
+    int num_shards = argc - optind;
+    if (!config.playlist_file || num_shards == 0) {
+        fprintf(stderr, "Error: Missing required arguments.\n\n");
+        print_merge_usage(prog_name);
+        return 1;
+    }
+    config.format = parse_format(format_str);
+    text_scan_init();
+    
+    // Check that the files are shards 1..N of one sweep before writing anything
+    shard_file_t *shards = calloc(num_shards, sizeof(shard_file_t));
+    if (!shards) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < num_shards; i++) {
+        shard_file_t shard;
+        if (!shard_file_read(&shard, argv[optind + i])) {
+            ok = false;
             break;
-        case FORMAT_XSPF:
-            fprintf(file, "    <track>\n");
-            fprintf(file, "      <location>%s</location>\n", full_url);
-            if (title) {
-                fprintf(file, "      <title>%s</title>\n", title);
+        }
+        const shard_header_t *h = &shard.header;
+        shard_file_t *first = shards[0].template_text ? &shards[0] : &shard;
+        int slot = (int)h->shard - 1;
+        if (h->shards != (uint32_t)num_shards) {
+            fprintf(stderr, "Error: '%s' is shard %u of %u, but %d shards were given.\n",
+                    argv[optind + i], h->shard, h->shards, num_shards);
+            ok = false;
+        } else if (h->start != first->header.start || h->end != first->header.end ||
+                   h->padding != first->header.padding || strcmp(shard.template_text, first->template_text) != 0) {
+            fprintf(stderr, "Error: '%s' belongs to a different sweep.\n", argv[optind + i]);
+            ok = false;
+        } else if (shards[slot].template_text) {
+            fprintf(stderr, "Error: Shard %u/%u was given twice.\n", h->shard, h->shards);
+            ok = false;
+        } else {
+            int first_index, last_index, reached;
+            if (!shard_file_complete(&shard, &first_index, &last_index, &reached)) {
+                fprintf(stderr, "Error: Shard %u/%u ('%s') is incomplete: its records end at index %d "
+                        "of block %d..%d.\n", h->shard, h->shards, argv[optind + i], reached,
+                        first_index, last_index);
+                ok = false;
             }
-            fprintf(file, "    </track>\n");
-            break;
-        default:
-            fprintf(file, "%s\n", full_url);
+        }
+        if (!ok) {
+            shard_file_free(&shard);
             break;
+        }
+        shards[slot] = shard;
+    }
+    
+    playlist_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.fd = -1;
+    job.journal.fd = -1;
+    job.quiet = true;
+    if (ok) {
+        config.link_template = shards[0].template_text;
+        config.start = shards[0].header.start;
+        config.end = shards[0].header.end;
+        config.padding = shards[0].header.padding;
+        if (strcmp(config.playlist_file, "-") == 0) {
+            config.output_fd = dup(STDOUT_FILENO);
+            if (config.output_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+                perror("Error redirecting output");
+                ok = false;
+            }
+        }
+        job.config = config;
     }
+    ok = ok && job_prepare(&job, NULL) && job_open(&job);
+    
+    // Each shard's records go through the --resume replay path
+    for (int i = 0; ok && i < num_shards; i++) {
+        job.journal.replay = shards[i].records;
+        job.journal.replay_count = shards[i].count;
+        shards[i].records = NULL;
+        ok = job_replay(&job);
+        free(job.journal.replay);
+        job.journal.replay = NULL;
+        job.journal.replay_count = 0;
+    }
+    if (ok) ok = job_close(&job);
+    if (ok) {
+        printf("Merged %d shards into '%s': %d valid, %d invalid URLs\n",
+               num_shards, config.playlist_file, job.run.valid_count, job.run.invalid_count);
+    }
+    
+    job_free(&job);
+    for (int i = 0; i < num_shards; i++) {
+        shard_file_free(&shards[i]);
+    }
+    free(shards);
+    return ok ? 0 : 1;
 }
 
-void write_playlist_footer(FILE *file, playlist_format_t format) {
-    if (format == FORMAT_XSPF) {
-        fprintf(file, "  </trackList>\n");
-        fprintf(file, "</playlist>\n");
-    }
+// Set by SIGINT/SIGTERM to end the --serve accept loop
+volatile sig_atomic_t serve_stopping = 0;
+
+void serve_stop(int signal_number) {
+    (void)signal_number;
+    serve_stopping = 1;
 }
 
-char *generate_url(const char *prefix, const char *suffix, int number, int padding) {
-    char *url = malloc(MAX_URL_LENGTH);
-    if (!url) return NULL;
+// Reply to a request that could not be served; nothing else has been sent
+void serve_reject(int client, const char *reason) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "ERR %s\n", reason);
+    write_all(client, line, (size_t)len);
+}
+
+// Answer one connection: read its request line and stream the playlist
+// back through a job on the shared engine
+void serve_request(int client, const config_t *defaults, verify_engine_t *engine, int number) {
+    char line[SERVE_REQUEST_MAX];
+    size_t len = 0;
+    while (len < sizeof(line) - 1) {
+        ssize_t n = read(client, line + len, sizeof(line) - 1 - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+        if (memchr(line + len - n, '\n', (size_t)n)) break;
+    }
+    line[len] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    // template [start [end [format [padding]]]], as in a --jobs manifest line without the output
+    char *fields[5] = {NULL};
+    int num_fields = split_tab_fields(line, fields, 5, 1);
+    if (num_fields < 1 || !fields[0] || fields[0][0] == '\0') {
+        serve_reject(client, "Expected a template");
+        return;
+    }
+    
+    playlist_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.config = *defaults;
+    job.number = number;
+    job.quiet = true;
+    job.fd = -1;
+    job.journal.fd = -1;
+    config_t *config = &job.config;
+    config->link_template = fields[0];
+    config->playlist_file = "-";
+    const char *problem = apply_range_fields(config, &fields[1]);
+    if (problem) {
+        serve_reject(client, problem);
+        return;
+    }
     
-    if (padding > 0) {
-        char format_str[16];
-        snprintf(format_str, sizeof(format_str), "%%s%%0%dd%%s", padding);
-        snprintf(url, MAX_URL_LENGTH, format_str, prefix, number, suffix);
+    // The job writes to its own descriptor for the connection and closes it
+    // when the playlist is done; the request's one stays to report errors.
+    // It is set before job_prepare so no file named "-" is ever probed.
+    config->output_fd = dup(client);
+    bool ok = config->output_fd >= 0;
+    if (!ok) {
+        serve_reject(client, "Cannot write the playlist");
+    } else if (!job_prepare(&job, engine)) {
+        close(config->output_fd);
+        serve_reject(client, "Request failed");
+        ok = false;
+    } else if (!job_open(&job)) {
+        if (job.fd < 0) close(config->output_fd);
+        serve_reject(client, "Cannot write the playlist");
+        ok = false;
+    } else if (config->verify_urls) {
+        ok = jobs_verify(engine, &job, 1, false);
     } else {
-        snprintf(url, MAX_URL_LENGTH, "%s%d%s", prefix, number, suffix);
+        ok = job_generate(&job) && job_close(&job);
     }
     
-    return url;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed_ms = (now.tv_sec - started.tv_sec) * 1e3 + (now.tv_nsec - started.tv_nsec) / 1e6;
+    printf("Request %d '%s': %s, %d entries written in %.1f ms\n", number, config->link_template,
+           ok && !job.failed ? "ok" : "failed", job.run.written_count, elapsed_ms);
+    fflush(stdout);
+    job_free(&job);
+}
+
+// --serve: answer playlist requests on a UNIX socket, one connection at a
+// time. The engine lives for the whole server, so its connection pool,
+// DNS cache and verification cache stay warm from one request to the next.
+int serve_requests(const char *path, const config_t *defaults, verify_engine_t *engine) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Error creating socket");
+        return 1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long.\n", path);
+        close(listener);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    // A socket left behind by a previous server is replaced
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, SERVE_BACKLOG) != 0) {
+        perror("Error listening on socket");
+        close(listener);
+        return 1;
+    }
+    
+    // A client that goes away mid-playlist fails that request, not the server
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+    action.sa_handler = serve_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    
+    printf("Serving playlists on '%s'\n", path);
+    fflush(stdout);
+    
+    struct timeval timeout = {SERVE_CLIENT_TIMEOUT, 0};
+    int served = 0;
+    while (!serve_stopping) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("Error accepting connection");
+            break;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_request(client, defaults, engine, ++served);
+        close(client);
+    }
+    
+    close(listener);
+    unlink(path);
+    printf("Served %d requests\n", served);
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) return merge_main(argc - 1, argv + 1, argv[0]);
+    
     config_t config = {
         .link_template = NULL,
         .playlist_file = NULL,
+        .output_fd = -1,
+        .compress = COMPRESS_NONE,
         .start = 0,
         .end = 0,
         .padding = 0,
@@ -187,6 +5471,33 @@ int main(int argc, char *argv[]) {
         .verify_urls = false,
         .verbose = false,
         .threads = 4,
+        .max_inflight = 0,
+        .http2 = false,
+        .http2_cleartext = false,
+        .max_host_connections = 0,
+        .discover = false,
+        .discover_gap = 0,
+        .cache_file = NULL,
+        .cache_ttl = DEFAULT_CACHE_TTL,
+        .incremental = false,
+        .gen_threads = 1,
+        .adaptive = false,
+        .max_retries = DEFAULT_MAX_RETRIES,
+        .timeout = DEFAULT_TIMEOUT,
+        .connect_timeout = 0,
+        .low_speed_time = 0,
+        .breaker_threshold = 0,
+        .probe_strategy = PROBE_HEAD,
+        .sniff_bytes = 0,
+        .stop_after_misses = 0,
+        .jobs_file = NULL,
+        .events = false,
+        .events_fd = DEFAULT_EVENTS_FD,
+        .journal = false,
+        .resume = false,
+        .shard = 0,
+        .shards = 0,
+        .serve_socket = NULL,
         .prefix_text = NULL,
         .suffix_text = NULL
     };
@@ -195,7 +5506,7 @@ int main(int argc, char *argv[]) {
     char *format_str = NULL;
     
     // Parse command-line options
-    while ((c = getopt(argc, argv, "l:s:e:p:f:z:vVt:P:S:h")) != -1) {
+    while ((c = getopt_long(argc, argv, "l:s:e:p:f:z:vVt:P:S:h", long_options, NULL)) != -1) {
         switch (c) {
             case 'l':
                 config.link_template = optarg;
@@ -231,6 +5542,144 @@ int main(int argc, char *argv[]) {
             case 'S':
                 config.suffix_text = optarg;
                 break;
+            case OPT_MAX_INFLIGHT:
+                config.max_inflight = atoi(optarg);
+                if (config.max_inflight < 1) config.max_inflight = 1;
+                break;
+            case OPT_HTTP2:
+                config.http2 = true;
+                break;
+            case OPT_HTTP2_CLEARTEXT:
+                config.http2 = true;
+                config.http2_cleartext = true;
+                break;
+            case OPT_MAX_HOST_CONNECTIONS:
+                config.max_host_connections = atoi(optarg);
+                if (config.max_host_connections < 0) config.max_host_connections = 0;
+                break;
+            case OPT_DISCOVER:
+                config.discover = true;
+                break;
+            case OPT_DISCOVER_GAP:
+                config.discover_gap = atoi(optarg);
+                if (config.discover_gap < 0) config.discover_gap = 0;
+                break;
+            case OPT_CACHE:
+                config.cache_file = optarg;
+                break;
+            case OPT_INDEX_SOURCE:
+                config.index_source = optarg;
+                break;
+            case OPT_CACHE_TTL:
+                config.cache_ttl = atoi(optarg);
+                if (config.cache_ttl < 0) config.cache_ttl = 0;
+                break;
+            case OPT_INCREMENTAL:
+                config.incremental = true;
+                break;
+            case OPT_GEN_THREADS:
+                config.gen_threads = atoi(optarg);
+                if (config.gen_threads < 1) config.gen_threads = 1;
+                break;
+            case OPT_ADAPTIVE:
+                config.adaptive = true;
+                break;
+            case OPT_MAX_RETRIES:
+                config.max_retries = atoi(optarg);
+                if (config.max_retries < 0) config.max_retries = 0;
+                break;
+            case OPT_TIMEOUT:
+                config.timeout = atof(optarg);
+                if (config.timeout < 0) config.timeout = 0;
+                break;
+            case OPT_CONNECT_TIMEOUT:
+                config.connect_timeout = atof(optarg);
+                if (config.connect_timeout < 0) config.connect_timeout = 0;
+                break;
+            case OPT_LOW_SPEED_TIME:
+                config.low_speed_time = atoi(optarg);
+                if (config.low_speed_time < 0) config.low_speed_time = 0;
+                break;
+            case OPT_BREAKER:
+                config.breaker_threshold = atoi(optarg);
+                if (config.breaker_threshold < 0) config.breaker_threshold = 0;
+                break;
+            case OPT_PROBE:
+                if (strcasecmp(optarg, "head") == 0) {
+                    config.probe_strategy = PROBE_HEAD;
+                } else if (strcasecmp(optarg, "range") == 0) {
+                    config.probe_strategy = PROBE_RANGE;
+                } else if (strcasecmp(optarg, "auto") == 0) {
+                    config.probe_strategy = PROBE_AUTO;
+                } else {
+                    fprintf(stderr, "Error: Unknown probe strategy '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_STATS:
+                config.stats = true;
+                break;
+            case OPT_STATS_JSON:
+                config.stats_json = optarg;
+                break;
+            case OPT_SNIFF:
+                config.sniff_bytes = atoi(optarg);
+                if (config.sniff_bytes < 0 || config.sniff_bytes > MAX_SNIFF_BYTES) {
+                    fprintf(stderr, "Error: --sniff must be between 0 and %d bytes.\n", MAX_SNIFF_BYTES);
+                    return 1;
+                }
+                break;
+            case OPT_STOP_AFTER_MISSES:
+                config.stop_after_misses = atoi(optarg);
+                if (config.stop_after_misses < 0) config.stop_after_misses = 0;
+                break;
+            case OPT_JOBS:
+                config.jobs_file = optarg;
+                break;
+            case OPT_EVENTS:
+                if (strcasecmp(optarg, "ndjson") != 0) {
+                    fprintf(stderr, "Error: Unknown event format '%s' (only ndjson is supported).\n", optarg);
+                    return 1;
+                }
+                config.events = true;
+                break;
+            case OPT_EVENTS_FD:
+                config.events_fd = atoi(optarg);
+                break;
+            case OPT_JOURNAL:
+                config.journal = true;
+                break;
+            case OPT_RESUME:
+                config.resume = true;
+                config.journal = true;
+                break;
+            case OPT_SERVE:
+                config.serve_socket = optarg;
+                break;
+            case OPT_SHARD: {
+                char extra;
+                if (sscanf(optarg, "%d/%d%c", &config.shard, &config.shards, &extra) != 2 ||
+                    config.shards < 1 || config.shard < 1 || config.shard > config.shards) {
+                    fprintf(stderr, "Error: --shard expects K/N with 1 <= K <= N.\n");
+                    return 1;
+                }
+                break;
+            }
+            case OPT_COMPRESS:
+                if (strcasecmp(optarg, "gzip") == 0) {
+                    config.compress = COMPRESS_GZIP;
+                } else if (strcasecmp(optarg, "zstd") == 0) {
+#ifdef HAVE_ZSTD
+                    config.compress = COMPRESS_ZSTD;
+#else
+                    fprintf(stderr, "Error: This build has no zstd support (build with -DHAVE_ZSTD -lzstd).\n");
+                    return 1;
+#endif
+                } else {
+                    fprintf(stderr, "Error: Unknown compression method '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -240,126 +5689,243 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    // Validate required arguments
-    if (!config.link_template || !config.playlist_file || config.start <= 0 || config.end <= 0) {
-        fprintf(stderr, "Error: Missing required arguments.\n\n");
-        print_usage(argv[0]);
-        return 1;
+    // Validate required arguments (-e is optional with --discover, and
+    // -s/-e are only needed when the template has a *); with --jobs the
+    // manifest supplies templates, ranges and outputs instead, and with
+    // --serve every request does
+    if (config.serve_socket) {
+        if (config.link_template || config.playlist_file || config.jobs_file || config.incremental ||
+            config.journal || config.shards > 0 || config.events) {
+            fprintf(stderr, "Error: --serve cannot be combined with -l, -p, --jobs, --incremental, "
+                            "--journal, --resume, --shard or --events.\n");
+            return 1;
+        }
+    } else if (config.jobs_file) {
+        if (config.link_template || config.playlist_file) {
+            fprintf(stderr, "Error: -l and -p cannot be combined with --jobs.\n");
+            return 1;
+        }
+    } else {
+        bool needs_range = config.link_template && strchr(config.link_template, '*');
+        if (!config.link_template || !config.playlist_file ||
+            (needs_range && (config.start <= 0 || (config.end <= 0 && !config.discover)))) {
+            fprintf(stderr, "Error: Missing required arguments.\n\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+    
+        if (config.end > 0 && config.start > config.end) {
+            fprintf(stderr, "Error: Start value cannot be greater than end value.\n");
+            return 1;
+        }
     }
     
-    if (config.start > config.end) {
-        fprintf(stderr, "Error: Start value cannot be greater than end value.\n");
+    // A stream can be neither appended to nor patched afterwards
+    bool to_stdout = config.playlist_file && strcmp(config.playlist_file, "-") == 0;
+    if (config.incremental && (to_stdout || config.compress != COMPRESS_NONE)) {
+        fprintf(stderr, "Error: --incremental needs an uncompressed output file.\n");
+        return 1;
+    }
+    if (config.journal && (!config.verify_urls || to_stdout || config.incremental)) {
+        fprintf(stderr, "Error: --journal and --resume need -v and an output file, without --incremental.\n");
+        return 1;
+    }
+    if (config.shards > 0 && (!config.verify_urls || to_stdout || config.compress != COMPRESS_NONE ||
+                              config.incremental)) {
+        fprintf(stderr, "Error: --shard needs -v and an uncompressed output file, without --incremental.\n");
+        return 1;
+    }
+    if (to_stdout && config.stats_json && strcmp(config.stats_json, "-") == 0) {
+        fprintf(stderr, "Error: -p - and --stats-json - cannot both write to stdout.\n");
         return 1;
     }
     
+    // The playlist takes over stdout and every message moves to stderr
+    if (to_stdout) {
+        config.output_fd = dup(STDOUT_FILENO);
+        if (config.output_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("Error redirecting output");
+            return 1;
+        }
+    }
+    
     // Parse format
     config.format = parse_format(format_str);
+    text_scan_init();
     
-    // Initialize CURL if URL verification is enabled
-    if (config.verify_urls) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
+    // HTTP/2 multiplexing needs the event-loop engine
+    if (config.http2) {
+        if (config.max_inflight == 0) config.max_inflight = DEFAULT_HTTP2_INFLIGHT;
+        if (config.max_host_connections == 0) config.max_host_connections = DEFAULT_HTTP2_HOST_CONNECTIONS;
+        if (!(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2)) {
+            fprintf(stderr, "Warning: libcurl was built without HTTP/2 support, probing over HTTP/1.1.\n");
+        }
     }
     
-    // Find wildcard and split template
-    char *asterisk = strchr(config.link_template, '*');
-    if (!asterisk) {
-        fprintf(stderr, "Error: No wildcard (*) found in template.\n");
-        return 1;
+    // In server mode one engine is set up here and serves every request
+    if (config.serve_socket) {
+        bool serve_curl = config.verify_urls || config.discover;
+        verify_engine_t serve_engine;
+        if (serve_curl) {
+            curl_global_init(CURL_GLOBAL_DEFAULT);
+            if (!verify_engine_init(&serve_engine, &config)) {
+                curl_global_cleanup();
+                return 1;
+            }
+        }
+        int status = serve_requests(config.serve_socket, &config, serve_curl ? &serve_engine : NULL);
+        if (serve_curl) {
+            if (config.stats) probe_stats_print(&serve_engine.stats, stdout);
+            verify_engine_destroy(&serve_engine);
+            curl_global_cleanup();
+        }
+        return status;
     }
     
-    char *link_prefix = strndup(config.link_template, asterisk - config.link_template);
-    char *link_suffix = strdup(asterisk + 1);
+    // One job from the command line, or one per manifest line
+    bool batch = config.jobs_file != NULL;
+    playlist_job_t *jobs;
+    int num_jobs = 1;
+    if (batch) {
+        if (!load_jobs(config.jobs_file, &config, &jobs, &num_jobs)) return 1;
+    } else {
+        jobs = calloc(1, sizeof(playlist_job_t));
+        if (!jobs) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            return 1;
+        }
+        jobs->config = config;
+        jobs->fd = -1;
+        jobs->journal.fd = -1;
+    }
     
-    if (!link_prefix || !link_suffix) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        return 1;
+    // Every job reports to the one event stream
+    event_stream_t events;
+    if (config.events) {
+        if (fcntl(config.events_fd, F_GETFD) < 0) {
+            fprintf(stderr, "Error: --events needs descriptor %d open (e.g. %d>events.ndjson).\n",
+                    config.events_fd, config.events_fd);
+            jobs_free(jobs, num_jobs);
+            return 1;
+        }
+        if (!event_stream_open(&events, config.events_fd)) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            jobs_free(jobs, num_jobs);
+            return 1;
+        }
+        for (int j = 0; j < num_jobs; j++) {
+            jobs[j].events = &events;
+        }
     }
     
-    // Open output file
-    FILE *file = fopen(config.playlist_file, "w");
-    if (!file) {
-        perror("Error opening output file");
-        free(link_prefix);
-        free(link_suffix);
-        return 1;
+    // Initialize CURL if URL verification is enabled; every job shares the
+    // one engine, so connections and the cache stay warm across jobs
+    bool use_curl = config.verify_urls || config.discover;
+    verify_engine_t engine;
+    if (use_curl) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        if (!verify_engine_init(&engine, &config)) {
+            jobs_free(jobs, num_jobs);
+            curl_global_cleanup();
+            return 1;
+        }
     }
     
-    // Calculate total entries
-    int total_entries = config.end - config.start + 1;
+    // Resolve every job before writing anything; in a batch a job that
+    // fails is reported and the others still run
+    for (int j = 0; j < num_jobs; j++) {
+        if (job_prepare(&jobs[j], use_curl ? &engine : NULL)) continue;
+        jobs[j].failed = true;
+        if (batch) {
+            fprintf(stderr, "Error: Job %d ('%s') skipped.\n", jobs[j].number, jobs[j].config.playlist_file);
+        }
+    }
     
-    // Write playlist header
-    write_playlist_header(file, config.format, total_entries);
+    bool run_ok = true;
+    if (!batch && (jobs->failed || jobs->up_to_date)) {
+        run_ok = false;
+    } else if (config.verify_urls) {
+        // Open the command-line job up front so a bad output path stops the
+        // run; jobs already covered by their journal are only replayed
+        if (!batch && !job_open(jobs)) {
+            run_ok = false;
+        } else {
+            jobs_replay_complete(jobs, num_jobs);
+            if (!jobs_verify(&engine, jobs, num_jobs, batch)) {
+                fprintf(stderr, "Error: Memory allocation failed.\n");
+                run_ok = false;
+            }
+        }
+    } else {
+        for (int j = 0; j < num_jobs; j++) {
+            if (!job_runnable(&jobs[j]) || !job_open(&jobs[j])) continue;
+            if (!job_generate(&jobs[j])) {
+                run_ok = false;
+                break;
+            }
+            job_close(&jobs[j]);
+        }
+    }
+    if (!batch && jobs->failed) run_ok = false;
     
-    // Generate URLs
+    int failed_jobs = 0;
     int valid_count = 0;
     int invalid_count = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        if (jobs[j].failed) failed_jobs++;
+        valid_count += jobs[j].run.valid_count;
+        invalid_count += jobs[j].run.invalid_count;
+    }
+    if (config.events && !event_stream_close(&events, num_jobs, failed_jobs, valid_count, invalid_count)) {
+        fprintf(stderr, "Warning: Failed to write events to descriptor %d.\n", config.events_fd);
+    }
     
-    printf("Generating playlist with %d entries...\n", total_entries);
+    if (!run_ok) {
+        int status = !batch && jobs->up_to_date && !jobs->failed ? 0 : 1;
+        if (use_curl) {
+            verify_engine_destroy(&engine);
+            curl_global_cleanup();
+        }
+        jobs_free(jobs, num_jobs);
+        return status;
+    }
     
-    for (int i = config.start; i <= config.end; i++) {
-        char *url = generate_url(link_prefix, link_suffix, i, config.padding);
-        if (!url) {
-            fprintf(stderr, "Error: Memory allocation failed for URL.\n");
-            continue;
+    if (config.verify_urls) {
+        if (batch) {
+            printf("\nBatch complete: %d jobs, %d failed, %d valid, %d invalid URLs\n",
+                   num_jobs, failed_jobs, valid_count, invalid_count);
+        } else {
+            printf("\nVerification complete: %d valid, %d invalid URLs\n", valid_count, invalid_count);
         }
-        
-        bool is_valid = true;
-        
-        // Verify URL if requested
-        if (config.verify_urls) {
-            if (config.verbose) {
-                printf("Checking: %s", url);
-                fflush(stdout);
-            }
-            
-            is_valid = check_url(url);
-            
-            if (config.verbose) {
-                printf(" [%s]\n", is_valid ? "OK" : "FAILED");
-            }
-            
-            if (is_valid) {
-                valid_count++;
-            } else {
-                invalid_count++;
-            }
+        if (config.breaker_threshold > 0 && engine.breaker.skipped > 0) {
+            printf("Circuit breaker: %ld probes skipped after repeated connection failures\n",
+                   engine.breaker.skipped);
         }
-        
-        // Write to playlist if valid or verification not requested
-        if (is_valid || !config.verify_urls) {
-            char title[256];
-            snprintf(title, sizeof(title), "Track %d", i);
-            write_playlist_entry(file, config.format, url, i - config.start + 1, 
-                               title, config.prefix_text, config.suffix_text);
+        if (config.index_source) {
+            printf("Index source: %ld entries listed, %ld probes answered without a request\n",
+                   engine.index.entries, engine.index.answered);
         }
-        
-        free(url);
-        
-        // Show progress
-        if (!config.verbose && (i - config.start + 1) % 10 == 0) {
-            printf("\rProgress: %d/%d", i - config.start + 1, total_entries);
-            fflush(stdout);
+        if (config.adaptive) {
+            printf("Adaptive concurrency: final limit %d, %ld throttled or timed-out probes\n",
+                   rate_limiter_allowed(&engine.limiter), engine.limiter.throttled);
         }
+    } else if (batch) {
+        printf("Batch complete: %d jobs, %d failed\n", num_jobs, failed_jobs);
     }
     
-    if (!config.verbose) {
-        printf("\rProgress: %d/%d\n", total_entries, total_entries);
-    }
-    
-    // Write playlist footer
-    write_playlist_footer(file, config.format);
-    
-    // Clean up
-    fclose(file);
-    free(link_prefix);
-    free(link_suffix);
-    
-    if (config.verify_urls) {
+    if (use_curl) {
+        if (config.stats) probe_stats_print(&engine.stats, stdout);
+        if (config.stats_json && !probe_stats_write_json(&engine.stats, config.stats_json)) {
+            fprintf(stderr, "Warning: Failed to write statistics to '%s'.\n", config.stats_json);
+        }
+        verify_engine_destroy(&engine);
         curl_global_cleanup();
-        printf("\nVerification complete: %d valid, %d invalid URLs\n", valid_count, invalid_count);
     }
     
-    printf("Playlist file '%s' created successfully.\n", config.playlist_file);
+    if (!batch) {
+        printf("Playlist file '%s' created successfully.\n", config.playlist_file);
+    }
+    jobs_free(jobs, num_jobs);
     
-    return 0;
+    return failed_jobs > 0 ? 1 : 0;
 }
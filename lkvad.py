@@ -1,28 +1,41 @@
 #!/usr/bin/env python3
 import argparse
+import threading
 import requests
+from collections import deque
 from concurrent.futures import ThreadPoolExecutor
-from urllib.parse import urlparse
-import xml.etree.ElementTree as ET
+from xml.sax.saxutils import escape
+
+# Probes kept in flight per verification thread; results are written in
+# index order, so this bounds both memory and how far ahead probing runs
+VERIFY_WINDOW_PER_THREAD = 4
+
+# Digits reserved for a PLS NumberOfEntries filled in after verification
+PLS_COUNT_WIDTH = 10
+
+XML_ENTITIES = {'"': '&quot;', "'": '&apos;'}
+
+_local = threading.local()
+
+def get_session():
+    """Return this thread's session, so connections are reused between probes."""
+    session = getattr(_local, 'session', None)
+    if session is None:
+        session = requests.Session()
+        _local.session = session
+    return session
 
 def verify_url(url, timeout=5):
     """Check if a URL is accessible."""
     try:
-        response = requests.head(url, timeout=timeout, allow_redirects=True)
+        response = get_session().head(url, timeout=timeout, allow_redirects=True)
+        response.close()
         return 200 <= response.status_code < 400
-    except:
+    except Exception:
         return False
 
-def generate_playlist(args):
-    """Generate playlist based on arguments."""
-    # Parse template
-    if '*' not in args.link:
-        raise ValueError("Template must contain wildcard (*)")
-    
-    prefix, suffix = args.link.split('*', 1)
-    
-    # Generate URLs
-    urls = []
+def generate_urls(args, prefix, suffix):
+    """Yield (index, url) for every number in the range."""
     for i in range(args.start, args.end + 1):
         if args.padding:
             num_str = str(i).zfill(args.padding)
@@ -34,52 +47,107 @@ def generate_playlist(args):
             url = args.prefix + url
         if args.suffix:
             url = url + args.suffix
-            
-        urls.append((i, url))
-    
-    # Verify URLs if requested
-    if args.verify:
-        print("Verifying URLs...")
-        valid_urls = []
-        with ThreadPoolExecutor(max_workers=args.threads) as executor:
-            results = list(executor.map(lambda u: (u[0], u[1], verify_url(u[1])), urls))
-            valid_urls = [(i, url) for i, url, valid in results if valid]
-            
-        print(f"Found {len(valid_urls)} valid URLs out of {len(urls)}")
-        urls = valid_urls
+        
+        yield i, url
+
+def verify_urls(urls, threads, stats):
+    """Yield the (index, url) pairs that verify, in input order.
+
+    At most VERIFY_WINDOW_PER_THREAD probes per thread are outstanding, so
+    the range is never materialized however long it is.
+    """
+    window = deque()
+    limit = threads * VERIFY_WINDOW_PER_THREAD
+    with ThreadPoolExecutor(max_workers=threads) as executor:
+        for i, url in urls:
+            window.append((i, url, executor.submit(verify_url, url)))
+            if len(window) >= limit:
+                yield from drain_verified(window, stats, 1)
+        yield from drain_verified(window, stats, len(window))
+
+def drain_verified(window, stats, count):
+    for _ in range(count):
+        i, url, future = window.popleft()
+        stats['checked'] += 1
+        if future.result():
+            stats['valid'] += 1
+            yield i, url
+
+class PlaylistWriter:
+    """Write a playlist one entry at a time."""
     
-    # Write playlist
-    with open(args.playlist, 'w') as f:
-        if args.format in ['m3u', 'm3u8']:
-            f.write("#EXTM3U\n")
-            for i, url in urls:
-                f.write(f"#EXTINF:-1,Track {i}\n")
-                f.write(f"{url}\n")
+    def __init__(self, f, format, total_entries=None):
+        self.f = f
+        self.format = format
+        self.count = 0
+        self.count_offset = None
         
-        elif args.format == 'pls':
+        if format in ['m3u', 'm3u8']:
+            f.write("#EXTM3U\n")
+        elif format == 'pls':
             f.write("[playlist]\n")
-            f.write(f"NumberOfEntries={len(urls)}\n")
-            f.write("Version=2\n\n")
-            for idx, (i, url) in enumerate(urls, 1):
-                f.write(f"File{idx}={url}\n")
-                f.write(f"Title{idx}=Track {i}\n")
-                f.write(f"Length{idx}=-1\n\n")
-        
-        elif args.format == 'xspf':
-            root = ET.Element('playlist', version='1', xmlns='http://xspf.org/ns/0/')
-            tracklist = ET.SubElement(root, 'trackList')
-            for i, url in urls:
-                track = ET.SubElement(tracklist, 'track')
-                ET.SubElement(track, 'location').text = url
-                ET.SubElement(track, 'title').text = f'Track {i}'
-            
-            tree = ET.ElementTree(root)
-            tree.write(args.playlist, encoding='UTF-8', xml_declaration=True)
-        
+            f.write("NumberOfEntries=")
+            if total_entries is None:
+                # Reserve the field and store the real count over it in close()
+                self.count_offset = f.tell()
+                f.write("0" * PLS_COUNT_WIDTH)
+            else:
+                f.write(str(total_entries))
+            f.write("\nVersion=2\n\n")
+        elif format == 'xspf':
+            f.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+            f.write('<playlist version="1" xmlns="http://xspf.org/ns/0/">\n')
+            f.write("  <trackList>\n")
+    
+    def add(self, i, url):
+        self.count += 1
+        if self.format in ['m3u', 'm3u8']:
+            self.f.write(f"#EXTINF:-1,Track {i}\n{url}\n")
+        elif self.format == 'pls':
+            idx = self.count
+            self.f.write(f"File{idx}={url}\nTitle{idx}=Track {i}\nLength{idx}=-1\n\n")
+        elif self.format == 'xspf':
+            self.f.write("    <track>\n"
+                         f"      <location>{escape(url, XML_ENTITIES)}</location>\n"
+                         f"      <title>Track {i}</title>\n"
+                         "    </track>\n")
         else:  # plain
-            for _, url in urls:
-                f.write(f"{url}\n")
+            self.f.write(f"{url}\n")
+    
+    def close(self):
+        if self.format == 'xspf':
+            self.f.write("  </trackList>\n")
+            self.f.write("</playlist>\n")
+        elif self.count_offset is not None:
+            self.f.seek(self.count_offset)
+            self.f.write(str(self.count).zfill(PLS_COUNT_WIDTH))
+            self.f.seek(0, 2)
+
+def generate_playlist(args):
+    """Generate playlist based on arguments."""
+    # Parse template
+    if '*' not in args.link:
+        raise ValueError("Template must contain wildcard (*)")
+    
+    prefix, suffix = args.link.split('*', 1)
     
+    # URLs are produced lazily and written as soon as they are known
+    urls = generate_urls(args, prefix, suffix)
+    total_entries = args.end - args.start + 1
+    stats = {'checked': 0, 'valid': 0}
+    if args.verify:
+        print("Verifying URLs...")
+        urls = verify_urls(urls, args.threads, stats)
+        total_entries = None
+    
+    with open(args.playlist, 'w', encoding='utf-8') as f:
+        writer = PlaylistWriter(f, args.format, total_entries)
+        for i, url in urls:
+            writer.add(i, url)
+        writer.close()
+    
+    if args.verify:
+        print(f"Found {stats['valid']} valid URLs out of {stats['checked']}")
     print(f"Playlist saved to {args.playlist}")
 
 def main():
@@ -88,7 +156,7 @@ def main():
     parser.add_argument('-s', '--start', type=int, required=True, help='Starting number')
     parser.add_argument('-e', '--end', type=int, required=True, help='Ending number')
     parser.add_argument('-p', '--playlist', required=True, help='Output playlist file')
-    parser.add_argument('-f', '--format', choices=['plain', 'm3u', 'm3u8', 'pls', 'xspf'], 
+    parser.add_argument('-f', '--format', choices=['plain', 'm3u', 'm3u8', 'pls', 'xspf'],
                         default='plain', help='Playlist format')
     parser.add_argument('-z', '--padding', type=int, help='Zero-pad numbers')
     parser.add_argument('-v', '--verify', action='store_true', help='Verify URLs')
@@ -100,6 +168,8 @@ def main():
     
     if args.start > args.end:
         parser.error("Start value cannot be greater than end value")
+    if args.threads < 1:
+        parser.error("Threads must be at least 1")
     
     generate_playlist(args)
 